@@ -0,0 +1,90 @@
+#ifndef SMARTHATA_HEATING_FRAMECHECK_H
+#define SMARTHATA_HEATING_FRAMECHECK_H
+
+#include <Arduino.h>
+#include <cstdio>
+#include "TelemetryFrame.h"
+
+/**
+ * Round trip of TelemetryFrameEncoder through a lossy link into TelemetryFrameDecoder. Every
+ * accepted frame must decode to the values sent, a delta after a lost frame must be refused
+ * until the next key frame, and a truncated copy of a frame must be refused without
+ * disturbing the decoder.
+ */
+class FrameCheck {
+public:
+
+    static const int LOSS_PERCENT = 5;
+
+    /**
+     * @return false on the first mismatch, which is printed
+     */
+    static bool run(unsigned long frames, uint32_t fields) {
+        TelemetryFrameEncoder encoder;
+        TelemetryFrameDecoder decoder;
+        encoder.setEnabled(true);
+
+        int32_t units[TELEMETRY_FIELDS_COUNT]{};
+        Telemetry sent;
+        uint8_t frame[TelemetryFrame::MAX_SIZE];
+        bool synced = false;
+        unsigned long lost = 0;
+        unsigned long refused = 0;
+
+        for (unsigned long n = 0; n < frames; ++n) {
+            for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+                long r = random(100);
+                if (r < 20) units[i] += random(-50, 50);
+                else if (r < 22) units[i] = random(-200000, 200000);
+                sent.values[i] = TelemetryFrame::fromFixed(units[i], TELEMETRY_FIELDS[i].decimals);
+            }
+            size_t length = encoder.encode(sent, fields, frame);
+            bool key = frame[0] & TelemetryFrame::KEY_FLAG;
+
+            if (random(100) < LOSS_PERCENT) {
+                lost++;
+                synced = false;
+                continue;
+            }
+
+            Telemetry received;
+            if (length > TelemetryFrame::HEADER_SIZE && decoder.decode(frame, length - 1, received)) {
+                printf("frames: truncated frame %lu accepted\n", n);
+                return false;
+            }
+
+            bool expected = key || synced;
+            bool accepted = decoder.decode(frame, length, received);
+            if (accepted != expected) {
+                printf("frames: frame %lu (%s) %s, expected %s\n", n, key ? "key" : "delta",
+                       accepted ? "accepted" : "refused", expected ? "accepted" : "refused");
+                return false;
+            }
+            if (!accepted) {
+                refused++;
+                continue;
+            }
+            synced = true;
+
+            if (decoder.getFields() != fields) {
+                printf("frames: frame %lu fields 0x%X, expected 0x%X\n", n, decoder.getFields(), fields);
+                return false;
+            }
+            for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+                if (!(fields & (1UL << i))) continue;
+                int32_t got = TelemetryFrame::toFixed(received.values[i], TELEMETRY_FIELDS[i].decimals);
+                if (got != units[i]) {
+                    printf("frames: frame %lu field %u decoded %ld, sent %ld\n", n, i, static_cast<long>(got),
+                           static_cast<long>(units[i]));
+                    return false;
+                }
+            }
+        }
+
+        printf("frames: %lu sent with fields 0x%X, %lu lost, %lu refused, all others decoded exactly\n",
+               frames, fields, lost, refused);
+        return true;
+    }
+};
+
+#endif
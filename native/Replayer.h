@@ -0,0 +1,204 @@
+#ifndef SMARTHATA_HEATING_REPLAYER_H
+#define SMARTHATA_HEATING_REPLAYER_H
+
+#include <Arduino.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SmarthataHeating.h"
+
+/**
+ * Replays an InputRecorder capture, the "<seq> <hex>" payloads of /heating/recorder one per line,
+ * against the firmware without the plant: the recorded states are written to flash before boot,
+ * sensor readings and MQTT messages are fed at their recorded times, and the relay outputs are
+ * compared with the recorded ones.
+ */
+class Replayer {
+public:
+
+    static const unsigned long MATCH_TOLERANCE_MS = 2000;
+    // the longest controller interval, booting on a multiple of it keeps the intervals in phase
+    static const unsigned long BOOT_ALIGN_MS = 10 * 60000UL;
+
+private:
+
+    struct Record {
+        uint32_t time;
+        InputEntryType type;
+        std::vector<uint8_t> data;
+    };
+
+    struct OutputEvent {
+        uint32_t time;
+        uint16_t mask;
+    };
+
+    std::vector<Record> records;
+    std::vector<OutputEvent> recorded;
+    std::vector<OutputEvent> replayed;
+    unsigned long gaps = 0;
+    unsigned long blocks = 0;
+
+public:
+
+    bool load(const char *path) {
+        FILE *file = fopen(path, "r");
+        if (file == nullptr) {
+            printf("replay: cannot open %s\n", path);
+            return false;
+        }
+
+        char line[1024];
+        long lastSeq = -1;
+        while (fgets(line, sizeof(line), file)) {
+            char *hex = nullptr;
+            long seq = strtol(line, &hex, 10);
+            if (hex == line || *hex != ' ') continue;
+            hex++;
+
+            std::vector<uint8_t> block;
+            for (; isxdigit(hex[0]) && isxdigit(hex[1]); hex += 2) {
+                char byteHex[3] = {hex[0], hex[1], '\0'};
+                block.push_back(static_cast<uint8_t>(strtoul(byteHex, nullptr, 16)));
+            }
+            if (lastSeq >= 0 && seq != lastSeq + 1) {
+                printf("replay: blocks %ld..%ld missing, inputs in between are lost\n", lastSeq + 1, seq - 1);
+                gaps++;
+            }
+            lastSeq = seq;
+            blocks++;
+
+            InputBlockReader reader(block.data(), block.size());
+            InputBlockReader::Entry entry{};
+            while (reader.next(entry)) {
+                records.push_back({entry.time, entry.type, std::vector<uint8_t>(entry.data, entry.data + entry.length)});
+            }
+        }
+        fclose(file);
+
+        if (records.empty()) {
+            printf("replay: no records in %s\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @param sensors simulated sensors in SensorRole order
+     * @return percentage of the recorded output changes the replay matched
+     */
+    double run(NativeSensor *sensors[], unsigned long stepMs) {
+        // the recorded millis() count from the device boot
+        nativeHal().now = records.front().time / BOOT_ALIGN_MS * BOOT_ALIGN_MS;
+        bool seeded[SENSOR_ROLES_COUNT]{};
+        for (const Record &record : records) {
+            if (record.type == INPUT_STATE) restoreState(record);
+            if (record.type == INPUT_SENSOR && record.data[0] < SENSOR_ROLES_COUNT && !seeded[record.data[0]]) {
+                seeded[record.data[0]] = true;
+                applySensor(record, sensors);
+            }
+        }
+
+        std::unique_ptr<SmarthataHeating> heating(new SmarthataHeating(ssid, pass));
+
+        const unsigned long end = records.back().time + MATCH_TOLERANCE_MS;
+        size_t next = 0;
+        uint16_t recordedMask = 0;
+        uint16_t replayedMask = 0xFFFF;
+        unsigned long differentMs = 0;
+        while (millis() < end) {
+            unsigned long now = millis();
+            for (; next < records.size() && records[next].time <= now; ++next) {
+                const Record &record = records[next];
+                if (record.type == INPUT_SENSOR) {
+                    applySensor(record, sensors);
+                } else if (record.type == INPUT_MQTT) {
+                    applyMqtt(record);
+                } else if (record.type == INPUT_OUTPUTS) {
+                    recordedMask = record.data[0] | record.data[1] << 8;
+                    // the replay sees one change per loop pass
+                    if (!recorded.empty() && recorded.back().time == record.time) recorded.pop_back();
+                    recorded.push_back({record.time, recordedMask});
+                }
+            }
+
+            heating->loop();
+
+            uint16_t mask = heating->outputs();
+            if (now >= records.front().time && mask != replayedMask) {
+                replayedMask = mask;
+                replayed.push_back({static_cast<uint32_t>(now), mask});
+            }
+            if (mask != recordedMask) differentMs += stepMs;
+            delay(stepMs);
+        }
+
+        return report(end - records.front().time, differentMs);
+    }
+
+private:
+
+    static void restoreState(const Record &record) {
+        ControllerState state{};
+        memcpy(&state, record.data.data() + 1, sizeof(state));
+        ControllerState stored{};
+        ControllerSnapshot snapshot;
+        snapshot.begin(record.data[0], stored);
+        snapshot.save(state);
+    }
+
+    static void applySensor(const Record &record, NativeSensor *sensors[]) {
+        byte role = record.data[0];
+        if (role >= SENSOR_ROLES_COUNT) return;
+        int16_t raw = static_cast<int16_t>(record.data[1] | record.data[2] << 8);
+        NativeSensor *sensor = sensors[role];
+        sensor->connected = raw != static_cast<int16_t>(DEVICE_DISCONNECTED_C * InputRecorder::RAW_PER_C);
+        if (sensor->connected) sensor->temp = sensor->scratchpad = static_cast<float>(raw) / InputRecorder::RAW_PER_C;
+    }
+
+    static void applyMqtt(const Record &record) {
+        const uint8_t *data = record.data.data();
+        std::string topic(reinterpret_cast<const char *>(data + 1), data[0]);
+        const uint8_t *payload = data + 1 + data[0];
+        nativeHal().mqttDeliver(topic.c_str(), std::string(reinterpret_cast<const char *>(payload + 1), payload[0]));
+    }
+
+    /**
+     * Pairs each recorded output change with the first unused replayed change to the same mask
+     * within MATCH_TOLERANCE_MS, in order.
+     */
+    double report(unsigned long durationMs, unsigned long differentMs) {
+        size_t matched = 0;
+        size_t from = 0;
+        const OutputEvent *divergence = nullptr;
+        for (const OutputEvent &event : recorded) {
+            size_t i = from;
+            while (i < replayed.size() && replayed[i].time + MATCH_TOLERANCE_MS < event.time) i++;
+            while (i < replayed.size() && replayed[i].time <= event.time + MATCH_TOLERANCE_MS &&
+                   replayed[i].mask != event.mask) {
+                i++;
+            }
+            if (i < replayed.size() && replayed[i].time <= event.time + MATCH_TOLERANCE_MS) {
+                matched++;
+                from = i + 1;
+            } else if (divergence == nullptr) {
+                divergence = &event;
+            }
+        }
+
+        printf("replay: %lu blocks, %lu gaps, %zu records over %.2f h\n", blocks, gaps, records.size(),
+               durationMs / 3600000.0);
+        double matchedPercent = recorded.empty() ? 100.0 : 100.0 * matched / recorded.size();
+        printf("replay: output changes recorded %zu, replayed %zu, matched %zu (%.1f%%)\n",
+               recorded.size(), replayed.size(), matched, matchedPercent);
+        printf("replay: outputs differ %.2f%% of the time\n", 100.0 * differentMs / max(durationMs, 1UL));
+        if (divergence != nullptr) {
+            printf("replay: first divergence at %.3f h, recorded mask 0x%X\n", divergence->time / 3600000.0,
+                   divergence->mask);
+        }
+        return matchedPercent;
+    }
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SMARTHATA_HEATING_THERMALPLANT_H
+#define SMARTHATA_HEATING_THERMALPLANT_H
+
+#include <Arduino.h>
+
+/**
+ * Lumped model of the boiler, the floor mixing valve, the floor slab and the room.
+ * Relays are sampled from the native HAL pins, so the unchanged firmware drives it.
+ */
+class ThermalPlant {
+public:
+    static constexpr float VALVE_TRAVEL_MS = 140000.0f;
+    static constexpr float STEP_SEC = 1.0f;
+
+    static constexpr float BOILER_MIN_TEMP = 60.0f;
+    static constexpr float BOILER_MAX_TEMP = 70.0f;
+    static constexpr float BOILER_HEAT_RATE = 2.0f / 60;
+    static constexpr float BOILER_COOL_RATE = 0.5f / 60;
+
+    static constexpr float MIXED_TAU_SEC = 30.0f;
+    static constexpr float FLOOR_RETURN_SHARE = 0.6f;
+    static constexpr float SLAB_WATER_RATE = 1.0f / (3 * 3600);
+    static constexpr float SLAB_ROOM_RATE = 0.8f / (3 * 3600);
+    static constexpr float ROOM_SLAB_RATE = 1.165e-4f;
+    static constexpr float ROOM_STREET_RATE = 2.9e-5f;
+    static constexpr float ROOM_RADIATOR_RATE = 2.5e-5f;
+    static constexpr float BATTERY_ON_TAU_SEC = 120.0f;
+    static constexpr float BATTERY_OFF_TAU_SEC = 1800.0f;
+
+    float streetMean = -5.0f;
+    float streetAmplitude = 5.0f;
+
+    float valvePosition = 0.5f;
+    bool burnerOn = true;
+    bool batteryPomp = false;
+
+    float boilerTemp = 65.0f;
+    float mixedTemp = 30.0f;
+    float floorColdTemp = 27.0f;
+    float slabTemp = 26.0f;
+    float roomTemp = 21.0f;
+    float batteryColdTemp = 21.0f;
+    float streetTemp = streetMean;
+
+    ThermalPlant(uint8_t mixerUpPin, uint8_t mixerDownPin, uint8_t batteryPompPin) :
+            mixerUpPin(mixerUpPin), mixerDownPin(mixerDownPin), batteryPompPin(batteryPompPin) {}
+
+    void step(unsigned long now) {
+        while (now - lastStep >= STEP_SEC * 1000) {
+            lastStep += static_cast<unsigned long>(STEP_SEC * 1000);
+            integrate(lastStep, STEP_SEC);
+        }
+    }
+
+private:
+    const uint8_t mixerUpPin;
+    const uint8_t mixerDownPin;
+    const uint8_t batteryPompPin;
+
+    unsigned long lastStep = 0;
+
+    static float approach(float value, float target, float tauSec, float dt) {
+        return value + (target - value) * dt / tauSec;
+    }
+
+    void integrate(unsigned long now, float dt) {
+        float hourOfDay = (now / 1000 % 86400) / 3600.0f;
+        streetTemp = streetMean - streetAmplitude * cosf(2 * (float) M_PI * (hourOfDay - 3) / 24);
+
+        bool up = nativeHal().pins[mixerUpPin];
+        bool down = nativeHal().pins[mixerDownPin];
+        if (up != down) {
+            valvePosition += (up ? 1 : -1) * dt * 1000 / VALVE_TRAVEL_MS;
+            valvePosition = constrain(valvePosition, 0.0f, 1.0f);
+        }
+        batteryPomp = nativeHal().pins[batteryPompPin];
+
+        if (boilerTemp >= BOILER_MAX_TEMP) burnerOn = false;
+        if (boilerTemp <= BOILER_MIN_TEMP) burnerOn = true;
+        boilerTemp += (burnerOn ? BOILER_HEAT_RATE : -BOILER_COOL_RATE) * dt;
+
+        float mixedTarget = valvePosition * boilerTemp + (1 - valvePosition) * floorColdTemp;
+        mixedTemp = approach(mixedTemp, mixedTarget, MIXED_TAU_SEC, dt);
+        floorColdTemp = slabTemp + (mixedTemp - slabTemp) * FLOOR_RETURN_SHARE;
+
+        float waterTemp = (mixedTemp + floorColdTemp) * 0.5f;
+        slabTemp += (SLAB_WATER_RATE * (waterTemp - slabTemp) - SLAB_ROOM_RATE * (slabTemp - roomTemp)) * dt;
+
+        // the radiator keeps giving off heat while it cools down after the pump stops
+        float radiator = ROOM_RADIATOR_RATE * (batteryColdTemp - roomTemp);
+        roomTemp += (ROOM_SLAB_RATE * (slabTemp - roomTemp) - ROOM_STREET_RATE * (roomTemp - streetTemp) + radiator) * dt;
+
+        batteryColdTemp = batteryPomp
+                          ? approach(batteryColdTemp, boilerTemp - 12, BATTERY_ON_TAU_SEC, dt)
+                          : approach(batteryColdTemp, roomTemp, BATTERY_OFF_TAU_SEC, dt);
+    }
+};
+
+#endif
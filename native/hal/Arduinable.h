@@ -0,0 +1,11 @@
+#ifndef SMARTHATA_HEATING_NATIVE_ARDUINABLE_H
+#define SMARTHATA_HEATING_NATIVE_ARDUINABLE_H
+
+class Arduinable {
+public:
+    virtual ~Arduinable() = default;
+
+    virtual void loop() = 0;
+};
+
+#endif
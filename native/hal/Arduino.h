@@ -0,0 +1,166 @@
+#ifndef SMARTHATA_HEATING_NATIVE_ARDUINO_H
+#define SMARTHATA_HEATING_NATIVE_ARDUINO_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/types.h>
+#include "NativeHal.h"
+#include "WString.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define LED_BUILTIN 2
+
+#define DEC 10
+#define HEX 16
+
+#define D0 16
+#define D4 2
+#define D5 14
+#define D6 12
+
+using std::min;
+using std::max;
+using std::round;
+using std::isinf;
+using std::isnan;
+
+#define constrain(amt, low, high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+inline unsigned long millis() {
+    return nativeHal().now;
+}
+
+inline unsigned long micros() {
+    nativeHal().spend(0);
+    return nativeHal().nowUs;
+}
+
+inline void delay(unsigned long ms) {
+    nativeHal().now += ms;
+}
+
+inline void yield() {}
+
+inline void pinMode(uint8_t, uint8_t) {}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < NativeHal::PINS_COUNT) nativeHal().pins[pin] = value != LOW;
+}
+
+inline int digitalRead(uint8_t pin) {
+    return pin < NativeHal::PINS_COUNT && nativeHal().pins[pin] ? HIGH : LOW;
+}
+
+inline long random(long howBig) {
+    return howBig > 0 ? rand() % howBig : 0;
+}
+
+inline long random(long howSmall, long howBig) {
+    return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+inline void randomSeed(unsigned long seed) {
+    srand(static_cast<unsigned int>(seed));
+}
+
+class Print {
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) {
+        if (nativeHal().serialEcho) putchar(c);
+        return 1;
+    }
+
+    size_t write(const char *str) {
+        size_t n = 0;
+        while (*str) n += write(static_cast<uint8_t>(*str++));
+        return n;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        for (size_t i = 0; i < size; ++i) write(buffer[i]);
+        return size;
+    }
+
+    size_t print(const char *str) { return write(str); }
+
+    size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+
+    size_t print(const String &str) { return write(str.c_str()); }
+
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+
+    size_t print(unsigned char number, int base = DEC) { return print((unsigned long) number, base); }
+
+    size_t print(int number, int base = DEC) { return print((long) number, base); }
+
+    size_t print(unsigned int number, int base = DEC) { return print((unsigned long) number, base); }
+
+    size_t print(long number, int base = DEC) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%ld", number);
+        return write(buf);
+    }
+
+    size_t print(unsigned long number, int base = DEC) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", number);
+        return write(buf);
+    }
+
+    size_t print(double number, int digits = 2) {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%.*f", digits, number);
+        return write(buf);
+    }
+
+    size_t println() { return write("\r\n"); }
+
+    template<typename T>
+    size_t println(const T &value) { return print(value) + println(); }
+
+    template<typename T>
+    size_t println(const T &value, int format) { return print(value, format) + println(); }
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long) {}
+
+    int availableForWrite() { return 128; }
+
+    void flush() {}
+};
+
+static HardwareSerial Serial;
+
+class EspClass {
+public:
+    void restart() { nativeHal().restartRequested = true; }
+
+    uint32_t getFreeHeap() { return nativeHal().heapFree; }
+
+    uint32_t getMaxFreeBlockSize() { return nativeHal().heapMaxBlock; }
+
+    uint8_t getHeapFragmentation() { return nativeHal().heapFragmentation; }
+
+    uint32_t getFreeContStack() { return nativeHal().contStackFree; }
+
+    uint32_t getChipId() { return 0x00C0FFEE; }
+};
+
+static EspClass ESP;
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SMARTHATA_HEATING_NATIVE_DALLASTEMPERATURE_H
+#define SMARTHATA_HEATING_NATIVE_DALLASTEMPERATURE_H
+
+#include <Arduino.h>
+#include "OneWire.h"
+
+#define DEVICE_DISCONNECTED_C -127
+
+typedef uint8_t DeviceAddress[8];
+
+/**
+ * A conversion takes its time by resolution, 750 ms at 12 bits. Until it ends the scratchpad
+ * keeps the previous reading, after it the sensor's temperature at the first read. A share of
+ * reads, nativeHal().sensorReadErrorPercent, fails the way a bad scratchpad CRC does.
+ */
+class DallasTemperature {
+private:
+    uint8_t resolution = 12;
+
+    static float quantize(float temp, uint8_t bits) {
+        float step = 1.0f / (1 << (bits - 8));
+        return round(temp / step) * step;
+    }
+
+    void convert(NativeSensor &sensor) const {
+        if (!sensor.connected) return;
+        sensor.converting = true;
+        sensor.convertedAt = millis() + conversionMs(resolution);
+    }
+
+    static unsigned long conversionMs(uint8_t bits) {
+        return 750UL >> (12 - bits);
+    }
+
+public:
+    explicit DallasTemperature(OneWire *) {}
+
+    void begin() {}
+
+    uint8_t getDeviceCount() {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < nativeHal().sensorsCount; ++i) {
+            if (nativeHal().sensors[i].connected) count++;
+        }
+        return count;
+    }
+
+    void setResolution(uint8_t bits) { resolution = bits; }
+
+    void setWaitForConversion(bool) {}
+
+    int16_t millisToWaitForConversion(uint8_t bits) {
+        return static_cast<int16_t>(conversionMs(bits));
+    }
+
+    void requestTemperatures() {
+        // skip ROM, convert
+        nativeHal().spend(NativeHal::ONEWIRE_RESET_US + NativeHal::ONEWIRE_BYTE_US * 2);
+        for (uint8_t i = 0; i < nativeHal().sensorsCount; ++i) {
+            convert(nativeHal().sensors[i]);
+        }
+    }
+
+    bool requestTemperaturesByAddress(const uint8_t *address) {
+        // match ROM with the address, convert
+        nativeHal().spend(NativeHal::ONEWIRE_RESET_US + NativeHal::ONEWIRE_BYTE_US * 10);
+        NativeSensor *sensor = nativeHal().findSensor(address);
+        if (sensor == nullptr || !sensor->connected) return false;
+        convert(*sensor);
+        return true;
+    }
+
+    float getTempC(const uint8_t *address) {
+        // match ROM with the address, read scratchpad, nine bytes back
+        nativeHal().spend(NativeHal::ONEWIRE_RESET_US + NativeHal::ONEWIRE_BYTE_US * 19);
+        NativeHal &hal = nativeHal();
+        NativeSensor *sensor = hal.findSensor(address);
+        if (sensor == nullptr || !sensor->connected) return DEVICE_DISCONNECTED_C;
+        if (sensor->converting && millis() >= sensor->convertedAt) {
+            sensor->scratchpad = quantize(sensor->temp, resolution);
+            sensor->converting = false;
+        }
+        if (hal.sensorReadErrorPercent > 0 && random(100) < hal.sensorReadErrorPercent) {
+            hal.sensorReadErrors++;
+            return DEVICE_DISCONNECTED_C;
+        }
+        return sensor->scratchpad;
+    }
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SMARTHATA_HEATING_NATIVE_DEVICEWIFI_H
+#define SMARTHATA_HEATING_NATIVE_DEVICEWIFI_H
+
+#include <Arduino.h>
+#include "Arduinable.h"
+
+#define DEBUG_SH(...)
+
+class DeviceWiFi : public Arduinable {
+public:
+    DeviceWiFi(const char *, const char *, unsigned long) {}
+
+    void loop() override {}
+};
+
+#endif
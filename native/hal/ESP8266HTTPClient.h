@@ -0,0 +1,73 @@
+#ifndef SMARTHATA_HEATING_NATIVE_ESP8266HTTPCLIENT_H
+#define SMARTHATA_HEATING_NATIVE_ESP8266HTTPCLIENT_H
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+/**
+ * Answers 200 to everything while the server is up. GET on nativeHal().firmwareUrl streams
+ * nativeHal().firmwareImage with its size and an x-MD5 header.
+ */
+class HTTPClient {
+private:
+    String url;
+    WiFiClient *client = nullptr;
+    bool firmware = false;
+
+    int request() {
+        nativeHal().httpRequests++;
+        nativeHal().spend(NativeHal::HTTP_REQUEST_US);
+        return nativeHal().wifiConnected && nativeHal().httpServerUp ? 200 : HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+
+public:
+    bool begin(const String &requestUrl) {
+        url = requestUrl;
+        return true;
+    }
+
+    bool begin(WiFiClient &wifiClient, const String &requestUrl) {
+        client = &wifiClient;
+        return begin(requestUrl);
+    }
+
+    void setTimeout(uint16_t) {}
+
+    void collectHeaders(const char *[], size_t) {}
+
+    int GET() {
+        int code = request();
+        firmware = false;
+        if (code != 200 || !url.equals(nativeHal().firmwareUrl.c_str())) return code;
+        if (nativeHal().firmwareImage.empty()) return 304;
+
+        firmware = true;
+        if (client != nullptr) client->attach(&nativeHal().firmwareImage);
+        return 200;
+    }
+
+    int getSize() {
+        return firmware ? static_cast<int>(nativeHal().firmwareImage.size()) : -1;
+    }
+
+    String header(const char *name) {
+        return firmware && strcmp(name, "x-MD5") == 0 ? String(nativeHal().firmwareMd5) : String("");
+    }
+
+    WiFiClient *getStreamPtr() {
+        return client;
+    }
+
+    int POST(const char *) { return request(); }
+
+    int POST(const String &) { return request(); }
+
+    void end() {
+        if (client != nullptr) client->detach();
+        firmware = false;
+    }
+};
+
+#endif
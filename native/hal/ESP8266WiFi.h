@@ -0,0 +1,38 @@
+#ifndef SMARTHATA_HEATING_NATIVE_ESP8266WIFI_H
+#define SMARTHATA_HEATING_NATIVE_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+class ESP8266WiFiClass {
+public:
+    bool isConnected() { return nativeHal().wifiConnected; }
+
+    int status() { return isConnected() ? 3 : 6; }
+};
+
+static ESP8266WiFiClass WiFi;
+
+class WiFiServer {
+private:
+    uint16_t port;
+    bool listening = false;
+
+public:
+    explicit WiFiServer(uint16_t port) : port(port) {}
+
+    void begin() { listening = true; }
+
+    WiFiClient available() {
+        std::deque<std::shared_ptr<NativeConnection>> &inbox = nativeHal().serverInbox;
+        for (auto it = inbox.begin(); listening && it != inbox.end(); ++it) {
+            if ((*it)->port != port) continue;
+            WiFiClient client(*it);
+            inbox.erase(it);
+            return client;
+        }
+        return WiFiClient();
+    }
+};
+
+#endif
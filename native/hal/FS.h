@@ -0,0 +1,103 @@
+#ifndef SMARTHATA_HEATING_NATIVE_FS_H
+#define SMARTHATA_HEATING_NATIVE_FS_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+typedef std::vector<uint8_t> NativeFileData;
+
+class File {
+private:
+    std::shared_ptr<NativeFileData> data;
+    size_t pos = 0;
+    bool append = false;
+
+public:
+    File() = default;
+
+    File(std::shared_ptr<NativeFileData> data, bool append) : data(std::move(data)), append(append) {}
+
+    explicit operator bool() const { return data != nullptr; }
+
+    size_t size() const { return data ? data->size() : 0; }
+
+    size_t position() const { return pos; }
+
+    bool seek(uint32_t offset, SeekMode mode = SeekSet) {
+        if (!data) return false;
+        size_t base = mode == SeekSet ? 0 : mode == SeekCur ? pos : data->size();
+        if (base + offset > data->size()) return false;
+        pos = base + offset;
+        return true;
+    }
+
+    int available() const { return data ? static_cast<int>(data->size() - pos) : 0; }
+
+    size_t read(uint8_t *buf, size_t size) {
+        if (!data) return 0;
+        size_t n = min(size, data->size() - pos);
+        memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    size_t write(const uint8_t *buf, size_t size) {
+        if (!data) return 0;
+        nativeHal().spend(NativeHal::FLASH_BYTE_US * size);
+        if (append) pos = data->size();
+        if (pos + size > data->size()) data->resize(pos + size);
+        memcpy(data->data() + pos, buf, size);
+        pos += size;
+        return size;
+    }
+
+    void close() { data.reset(); }
+};
+
+/**
+ * In-memory flash filesystem, shared by every File opened on a path.
+ */
+class NativeFS {
+private:
+    std::map<std::string, std::shared_ptr<NativeFileData>> files;
+
+public:
+    bool begin() { return true; }
+
+    bool exists(const char *path) const { return files.count(path) > 0; }
+
+    bool remove(const char *path) { return files.erase(path) > 0; }
+
+    File open(const char *path, const char *mode) {
+        nativeHal().spend(NativeHal::FLASH_OPEN_US);
+        std::string m = mode;
+        auto it = files.find(path);
+        if (m == "r" || m == "r+") {
+            if (it == files.end()) return File();
+            return File(it->second, false);
+        }
+        if (it == files.end() || m == "w" || m == "w+") {
+            files[path] = std::make_shared<NativeFileData>();
+            it = files.find(path);
+        }
+        return File(it->second, m[0] == 'a');
+    }
+};
+
+inline NativeFS &nativeFS() {
+    static NativeFS fs;
+    return fs;
+}
+
+#define SPIFFS nativeFS()
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SMARTHATA_HEATING_NATIVE_INTERVAL_H
+#define SMARTHATA_HEATING_NATIVE_INTERVAL_H
+
+#include <Arduino.h>
+
+class Interval {
+private:
+    unsigned long interval;
+    unsigned long lastTime = 0;
+
+public:
+    explicit Interval(unsigned long interval) : interval(interval) {}
+
+    void startWithCurrentTime() {
+        lastTime = millis();
+    }
+
+    void startWithCurrentTimeEnabled() {
+        lastTime = millis() - interval;
+    }
+
+    void setInterval(unsigned long newInterval) {
+        interval = newInterval;
+    }
+
+    bool isReady() {
+        if (millis() - lastTime >= interval) {
+            lastTime = millis();
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif
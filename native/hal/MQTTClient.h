@@ -0,0 +1,91 @@
+#ifndef SMARTHATA_HEATING_NATIVE_MQTTCLIENT_H
+#define SMARTHATA_HEATING_NATIVE_MQTTCLIENT_H
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+class MQTTClient;
+
+typedef void (*MQTTClientCallbackSimple)(String &topic, String &payload);
+
+typedef void (*MQTTClientCallbackAdvanced)(MQTTClient *client, char topic[], char bytes[], int length);
+
+class MQTTClient {
+private:
+    static const uint8_t SUBSCRIPTIONS_MAX = 16;
+
+    MQTTClientCallbackSimple callback = nullptr;
+    MQTTClientCallbackAdvanced advancedCallback = nullptr;
+    bool isConnected = false;
+    String subscriptions[SUBSCRIPTIONS_MAX];
+    uint8_t subscriptionsCount = 0;
+
+    bool isSubscribed(const String &topic) const {
+        for (uint8_t i = 0; i < subscriptionsCount; ++i) {
+            if (subscriptions[i] == topic) return true;
+        }
+        return false;
+    }
+
+public:
+    explicit MQTTClient(int = 128) {}
+
+    void begin(const char *, int, Client &) {}
+
+    void setOptions(int, bool, int) {}
+
+    void onMessage(MQTTClientCallbackSimple cb) { callback = cb; }
+
+    void onMessageAdvanced(MQTTClientCallbackAdvanced cb) { advancedCallback = cb; }
+
+    bool connect(const char *, const char * = nullptr, const char * = nullptr) {
+        isConnected = nativeHal().wifiConnected && nativeHal().mqttBrokerUp;
+        subscriptionsCount = 0;
+        return isConnected;
+    }
+
+    bool connected() {
+        if (!nativeHal().wifiConnected || !nativeHal().mqttBrokerUp) isConnected = false;
+        return isConnected;
+    }
+
+    bool subscribe(const char *topic, int = 0) {
+        if (!connected() || subscriptionsCount >= SUBSCRIPTIONS_MAX) return false;
+        subscriptions[subscriptionsCount++] = topic;
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained = false, int qos = 0) {
+        return publish(topic, payload, static_cast<int>(strlen(payload)), retained, qos);
+    }
+
+    bool publish(const char *topic, const char *payload, int length, bool, int) {
+        if (!connected()) return false;
+        nativeHal().spend(NativeHal::MQTT_PUBLISH_US + NativeHal::MQTT_BYTE_US * length);
+        nativeHal().mqttPublished++;
+        nativeHal().mqttPublishedBytes += length;
+        if (nativeHal().onMqttPublish) nativeHal().onMqttPublish(topic, payload, static_cast<size_t>(length));
+        return true;
+    }
+
+    bool loop() {
+        NativeHal &hal = nativeHal();
+        while (connected() && !hal.mqttInbox.empty()) {
+            NativeMqttMessage message = hal.mqttInbox.front();
+            hal.mqttInbox.pop_front();
+            String topic = message.topic;
+            String payload = message.payload;
+            if (!isSubscribed(topic)) continue;
+            if (advancedCallback) {
+                advancedCallback(this, &message.topic[0], &message.payload[0], static_cast<int>(message.payload.size()));
+            } else if (callback) {
+                callback(topic, payload);
+            }
+        }
+        return connected();
+    }
+
+    void disconnect() { isConnected = false; }
+};
+
+#endif
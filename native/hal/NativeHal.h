@@ -0,0 +1,131 @@
+#ifndef SMARTHATA_HEATING_NATIVEHAL_H
+#define SMARTHATA_HEATING_NATIVEHAL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct NativeSensor {
+    uint8_t address[8];
+    float temp;
+    float scratchpad;
+    bool connected;
+    bool converting;
+    unsigned long convertedAt;
+};
+
+struct NativeMqttMessage {
+    std::string topic;
+    std::string payload;
+};
+
+/**
+ * Inbound TCP connection to a WiFiServer, the request is read by the firmware and the response collected.
+ */
+struct NativeConnection {
+    uint16_t port;
+    std::string request;
+    size_t position = 0;
+    std::string response;
+    bool open = true;
+};
+
+struct NativeHal {
+    static const uint8_t PINS_COUNT = 64;
+    static const uint8_t SENSORS_MAX = 16;
+
+    unsigned long now = 0;
+    bool serialEcho = false;
+
+    // micros() never runs behind now, the blocking bus, flash and network calls of the stubs
+    // push it ahead by what they take on the device, so task durations and the pass budget
+    // see them, millis() still moves only between simulator steps
+    unsigned long nowUs = 0;
+    static const unsigned long ONEWIRE_RESET_US = 960;
+    static const unsigned long ONEWIRE_BYTE_US = 560;
+    static const unsigned long MQTT_PUBLISH_US = 1500;
+    static const unsigned long MQTT_BYTE_US = 2;
+    static const unsigned long HTTP_REQUEST_US = 120000;
+    static const unsigned long FLASH_OPEN_US = 400;
+    static const unsigned long FLASH_BYTE_US = 4;
+
+    bool pins[PINS_COUNT]{};
+
+    NativeSensor sensors[SENSORS_MAX]{};
+    uint8_t sensorsCount = 0;
+    // share of scratchpad reads that fail their CRC and read as disconnected
+    uint8_t sensorReadErrorPercent = 0;
+    unsigned long sensorReadErrors = 0;
+
+    bool wifiConnected = true;
+    bool mqttBrokerUp = true;
+    std::deque<NativeMqttMessage> mqttInbox;
+    void (*onMqttPublish)(const char *topic, const char *payload, size_t length) = nullptr;
+    unsigned long mqttPublished = 0;
+    unsigned long mqttPublishedBytes = 0;
+
+    std::deque<std::shared_ptr<NativeConnection>> serverInbox;
+    size_t serverWriteChunk = 256;
+
+    bool httpServerUp = true;
+    unsigned long httpRequests = 0;
+
+    bool restartRequested = false;
+
+    // what the ESP heap and stack queries report
+    uint32_t heapFree = 40000;
+    uint32_t heapMaxBlock = 36000;
+    uint8_t heapFragmentation = 10;
+    uint32_t contStackFree = 2400;
+
+    // firmware served by the HTTP stand-in at firmwareUrl, streamed at firmwareBytesPerMs
+    std::string firmwareUrl;
+    std::vector<uint8_t> firmwareImage;
+    std::string firmwareMd5;
+    unsigned long firmwareBytesPerMs = 50;
+    bool firmwareFlashed = false;
+
+    void spend(unsigned long us) {
+        nowUs = std::max(nowUs, now * 1000) + us;
+    }
+
+    NativeSensor &addSensor(const uint8_t *address, float temp) {
+        NativeSensor &sensor = sensors[sensorsCount++];
+        memcpy(sensor.address, address, 8);
+        sensor.temp = temp;
+        sensor.scratchpad = temp;
+        sensor.connected = true;
+        sensor.converting = false;
+        return sensor;
+    }
+
+    NativeSensor *findSensor(const uint8_t *address) {
+        for (uint8_t i = 0; i < sensorsCount; ++i) {
+            if (memcmp(sensors[i].address, address, 8) == 0) return &sensors[i];
+        }
+        return nullptr;
+    }
+
+    void mqttDeliver(const char *topic, const std::string &payload) {
+        mqttInbox.push_back({topic, payload});
+    }
+
+    std::shared_ptr<NativeConnection> connect(uint16_t port, const std::string &request) {
+        auto connection = std::make_shared<NativeConnection>();
+        connection->port = port;
+        connection->request = request;
+        serverInbox.push_back(connection);
+        return connection;
+    }
+};
+
+inline NativeHal &nativeHal() {
+    static NativeHal hal;
+    return hal;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SMARTHATA_HEATING_NATIVE_ONEWIRE_H
+#define SMARTHATA_HEATING_NATIVE_ONEWIRE_H
+
+#include <Arduino.h>
+
+class OneWire {
+private:
+    uint8_t searchIndex = 0;
+
+public:
+    explicit OneWire(uint8_t) {}
+
+    void reset_search() { searchIndex = 0; }
+
+    static uint8_t crc8(const uint8_t *addr, uint8_t len) {
+        uint8_t crc = 0;
+        while (len--) {
+            uint8_t inbyte = *addr++;
+            for (uint8_t i = 8; i; i--) {
+                uint8_t mix = (crc ^ inbyte) & 0x01;
+                crc >>= 1;
+                if (mix) crc ^= 0x8C;
+                inbyte >>= 1;
+            }
+        }
+        return crc;
+    }
+
+    bool search(uint8_t *address) {
+        NativeHal &hal = nativeHal();
+        // a search step is a reset and three time slots per address bit
+        hal.spend(NativeHal::ONEWIRE_RESET_US + NativeHal::ONEWIRE_BYTE_US * 24);
+        while (searchIndex < hal.sensorsCount) {
+            const NativeSensor &sensor = hal.sensors[searchIndex++];
+            if (sensor.connected) {
+                memcpy(address, sensor.address, 8);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
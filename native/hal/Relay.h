@@ -0,0 +1,36 @@
+#ifndef SMARTHATA_HEATING_NATIVE_RELAY_H
+#define SMARTHATA_HEATING_NATIVE_RELAY_H
+
+#include <Arduino.h>
+
+class Relay {
+private:
+    uint8_t pin;
+    bool enabled = false;
+
+public:
+    explicit Relay(uint8_t pin) : pin(pin) {
+        pinMode(pin, OUTPUT);
+        disable();
+    }
+
+    void enable() {
+        enabled = true;
+        digitalWrite(pin, HIGH);
+    }
+
+    void disable() {
+        enabled = false;
+        digitalWrite(pin, LOW);
+    }
+
+    void toggle() {
+        enabled ? disable() : enable();
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SMARTHATA_HEATING_NATIVE_TIMEOUT_H
+#define SMARTHATA_HEATING_NATIVE_TIMEOUT_H
+
+#include <Arduino.h>
+
+class Timeout {
+private:
+    unsigned long startTime = 0;
+    unsigned long timeout = 0;
+
+public:
+    explicit Timeout(unsigned long timeout = 0) {
+        start(timeout);
+    }
+
+    void start(unsigned long newTimeout) {
+        timeout = newTimeout;
+        startTime = millis();
+    }
+
+    bool isReady() const {
+        return millis() - startTime >= timeout;
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SMARTHATA_HEATING_NATIVE_UPDATER_H
+#define SMARTHATA_HEATING_NATIVE_UPDATER_H
+
+#include <Arduino.h>
+#include "MD5Builder.h"
+
+#define UPDATE_ERROR_OK 0
+#define UPDATE_ERROR_ABORT 1
+#define UPDATE_ERROR_MD5 2
+
+/**
+ * Update partition stand-in: counts the written bytes and checks the MD5 in end().
+ * A successful end() sets nativeHal().firmwareFlashed.
+ */
+class UpdaterClass {
+private:
+    bool running = false;
+    size_t size = 0;
+    size_t progress = 0;
+    std::string targetMd5;
+    MD5Builder md5;
+    uint8_t error = UPDATE_ERROR_OK;
+
+public:
+    bool begin(size_t imageSize) {
+        running = true;
+        size = imageSize;
+        progress = 0;
+        targetMd5.clear();
+        error = UPDATE_ERROR_OK;
+        md5.begin();
+        return true;
+    }
+
+    bool setMD5(const char *expected) {
+        targetMd5 = expected;
+        return true;
+    }
+
+    size_t write(uint8_t *data, size_t length) {
+        if (!running) return 0;
+        md5.add(data, length);
+        progress += length;
+        return length;
+    }
+
+    bool end(bool evenIfRemaining = false) {
+        if (!running) return false;
+        running = false;
+        if (progress < size && !evenIfRemaining) {
+            error = UPDATE_ERROR_ABORT;
+            return false;
+        }
+        md5.calculate();
+        if (!targetMd5.empty() && md5.toString() != targetMd5) {
+            error = UPDATE_ERROR_MD5;
+            return false;
+        }
+        nativeHal().firmwareFlashed = true;
+        return true;
+    }
+
+    bool isRunning() const { return running; }
+
+    bool hasError() const { return error != UPDATE_ERROR_OK; }
+
+    uint8_t getError() const { return error; }
+};
+
+static UpdaterClass Update;
+
+#endif
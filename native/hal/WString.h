@@ -0,0 +1,120 @@
+#ifndef SMARTHATA_HEATING_NATIVE_WSTRING_H
+#define SMARTHATA_HEATING_NATIVE_WSTRING_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+class __FlashStringHelper;
+
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class String {
+private:
+    std::string value;
+
+    template<typename T>
+    static std::string format(const char *pattern, T number) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), pattern, number);
+        return buf;
+    }
+
+public:
+    String(const char *str = "") : value(str ? str : "") {}
+
+    String(const std::string &str) : value(str) {}
+
+    String(const __FlashStringHelper *str) : value(reinterpret_cast<const char *>(str)) {}
+
+    explicit String(char c) : value(1, c) {}
+
+    explicit String(int number) : value(format("%d", number)) {}
+
+    explicit String(unsigned int number) : value(format("%u", number)) {}
+
+    explicit String(long number) : value(format("%ld", number)) {}
+
+    explicit String(unsigned long number) : value(format("%lu", number)) {}
+
+    explicit String(float number, unsigned int decimals = 2) : String((double) number, decimals) {}
+
+    explicit String(double number, unsigned int decimals = 2) {
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, number);
+        value = buf;
+    }
+
+    const char *c_str() const { return value.c_str(); }
+
+    unsigned int length() const { return static_cast<unsigned int>(value.length()); }
+
+    bool reserve(unsigned int size) {
+        value.reserve(size);
+        return true;
+    }
+
+    bool equals(const String &other) const { return value == other.value; }
+
+    bool equals(const char *other) const { return value == other; }
+
+    bool operator==(const String &other) const { return equals(other); }
+
+    bool operator==(const char *other) const { return equals(other); }
+
+    bool operator!=(const String &other) const { return !equals(other); }
+
+    char operator[](unsigned int index) const { return index < value.length() ? value[index] : 0; }
+
+    bool startsWith(const String &prefix) const { return value.compare(0, prefix.value.length(), prefix.value) == 0; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t pos = value.find(c, from);
+        return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    String substring(unsigned int from, unsigned int to) const { return value.substr(from, to - from); }
+
+    String substring(unsigned int from) const { return value.substr(from); }
+
+    long toInt() const { return strtol(value.c_str(), nullptr, 10); }
+
+    float toFloat() const { return strtof(value.c_str(), nullptr); }
+
+    bool concat(const String &str) {
+        value += str.value;
+        return true;
+    }
+
+    bool concat(const char *str) {
+        value += str;
+        return true;
+    }
+
+    bool concat(char c) {
+        value += c;
+        return true;
+    }
+
+    template<typename T>
+    bool concat(T number) { return concat(String(number)); }
+
+    template<typename T>
+    String &operator+=(const T &other) {
+        concat(other);
+        return *this;
+    }
+
+    template<typename T>
+    String operator+(const T &other) const {
+        String result(*this);
+        result.concat(other);
+        return result;
+    }
+};
+
+inline String operator+(const char *lhs, const String &rhs) {
+    return String(lhs) + rhs;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef SMARTHATA_HEATING_NATIVE_WIFICLIENT_H
+#define SMARTHATA_HEATING_NATIVE_WIFICLIENT_H
+
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+
+class Client : public Print {
+};
+
+/**
+ * Response body stream, bytes become available at nativeHal().firmwareBytesPerMs
+ * as the virtual clock advances. A client accepted by WiFiServer reads the request of
+ * its NativeConnection instead and writes at most nativeHal().serverWriteChunk bytes per millisecond.
+ */
+class WiFiClient : public Client {
+private:
+    std::shared_ptr<NativeConnection> connection;
+    unsigned long writtenAt = 0;
+    size_t written = 0;
+    const std::vector<uint8_t> *body = nullptr;
+    size_t position = 0;
+    size_t released = 0;
+    unsigned long releasedAt = 0;
+
+public:
+    void attach(const std::vector<uint8_t> *data) {
+        body = data;
+        position = 0;
+        released = 0;
+        releasedAt = millis();
+    }
+
+    void detach() {
+        body = nullptr;
+    }
+
+    explicit WiFiClient(std::shared_ptr<NativeConnection> accepted = nullptr) : connection(std::move(accepted)) {}
+
+    explicit operator bool() const {
+        return connection != nullptr;
+    }
+
+    bool connected() const {
+        return connection != nullptr && connection->open;
+    }
+
+    int read() {
+        if (!connected() || connection->position >= connection->request.size()) return -1;
+        return static_cast<uint8_t>(connection->request[connection->position++]);
+    }
+
+    size_t availableForWrite() {
+        if (!connected()) return 0;
+        if (writtenAt != millis()) {
+            writtenAt = millis();
+            written = 0;
+        }
+        return nativeHal().serverWriteChunk - written;
+    }
+
+    size_t write(const uint8_t *data, size_t length) {
+        length = min(length, availableForWrite());
+        if (length == 0) return 0;
+        connection->response.append(reinterpret_cast<const char *>(data), length);
+        written += length;
+        return length;
+    }
+
+    void stop() {
+        if (connection != nullptr) connection->open = false;
+        connection = nullptr;
+    }
+
+    int available() {
+        if (connection != nullptr) return connected() ? static_cast<int>(connection->request.size() - connection->position) : 0;
+        if (body == nullptr || !nativeHal().wifiConnected) return 0;
+        released += (millis() - releasedAt) * nativeHal().firmwareBytesPerMs;
+        releasedAt = millis();
+        if (released > body->size()) released = body->size();
+        return static_cast<int>(released - position);
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length) {
+        size_t count = min(length, static_cast<size_t>(available()));
+        memcpy(buffer, body->data() + position, count);
+        position += count;
+        return count;
+    }
+};
+
+#endif
@@ -0,0 +1,351 @@
+#include <Arduino.h>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <vector>
+#include "config.h"
+#include "SmarthataHeating.h"
+#include "ThermalPlant.h"
+#include "MD5Builder.h"
+#include "Replayer.h"
+#include "FrameCheck.h"
+
+static const unsigned long MINUTE_MS = 60000UL;
+static const unsigned long HOUR_MS = 60 * MINUTE_MS;
+static const unsigned long DAY_MS = 24 * HOUR_MS;
+
+struct SimulationStats {
+    unsigned long samples = 0;
+    double roomSum = 0;
+    float roomMin = 100;
+    float roomMax = -100;
+    double roomErrorSum = 0;
+    float roomOvershootMax = -100;
+    double floorErrorSum = 0;
+    unsigned long floorErrorSamples = 0;
+    float floorCorrected = NAN;
+    unsigned long valveMovingMs = 0;
+    unsigned long pompOnMs = 0;
+    unsigned long messages = 0;
+    unsigned long backlogRecords = 0;
+    unsigned long restarts = 0;
+    unsigned long framesRefused = 0;
+} stats;
+
+static FILE *recording = nullptr;
+
+struct ScheduledMessage {
+    unsigned long at;
+    const char *topic;
+    const char *payload;
+};
+
+static TelemetryFrameDecoder floorDecoder;
+
+static void onMqttPublish(const char *topic, const char *payload, size_t length) {
+    if (strcmp(topic, "/heating/floor") == 0 && length > 0 && payload[0] != '{') {
+        Telemetry telemetry;
+        if (floorDecoder.decode(reinterpret_cast<const uint8_t *>(payload), length, telemetry)) {
+            stats.floorCorrected = telemetry[FLOOR_CORRECTED];
+        } else {
+            stats.framesRefused++;
+        }
+        if (nativeHal().serialEcho) printf("mqtt [%s] %zu byte frame\n", topic, length);
+        return;
+    }
+    if (strcmp(topic, "/heating/floor") == 0) {
+        const char *corrected = strstr(payload, "\"floor-corrected\":");
+        if (corrected) stats.floorCorrected = strtof(corrected + strlen("\"floor-corrected\":"), nullptr);
+    } else if (strcmp(topic, "/heating/floor/backlog") == 0) {
+        for (const char *c = strchr(payload, '\n'); c && c[1]; c = strchr(c + 1, '\n')) stats.backlogRecords++;
+    } else if (strcmp(topic, "/messages") == 0) {
+        stats.messages++;
+    } else if (recording != nullptr && strcmp(topic, InputRecorder::TOPIC) == 0) {
+        fprintf(recording, "%s\n", payload);
+    }
+    if (nativeHal().serialEcho) printf("mqtt [%s] %s\n", topic, payload);
+}
+
+static void updateSensors(const ThermalPlant &plant, NativeSensor *sensors[]) {
+    sensors[0]->temp = plant.mixedTemp;
+    sensors[1]->temp = plant.floorColdTemp;
+    sensors[2]->temp = plant.boilerTemp;
+    sensors[3]->temp = plant.batteryColdTemp;
+    sensors[4]->temp = plant.boilerTemp;
+    sensors[5]->temp = plant.streetTemp;
+}
+
+static void deliverMqtt(const ThermalPlant &plant, unsigned long now, bool room) {
+    char payload[64];
+    snprintf(payload, sizeof(payload), "%lu", now / 1000 % 86400);
+    nativeHal().mqttDeliver("/second-of-day", payload);
+    if (!room) return;
+    snprintf(payload, sizeof(payload), "{\"temp\":%.2f,\"hum\":40}", plant.roomTemp);
+    nativeHal().mqttDeliver("/room/bedroom", payload);
+}
+
+/**
+ * Reboots the firmware: the in-memory flash survives, RAM globals start over.
+ */
+static void restart(std::unique_ptr<SmarthataHeating> &heating) {
+    heating.reset();
+    th = SmartHeatingDto();
+    mqttUpdate = MqttUpdate();
+    mqttRouter = decltype(mqttRouter)();
+    localClock = LocalClock();
+    weeklySchedule = WeeklySchedule();
+    inputRecorder = InputRecorder();
+    nativeHal().restartRequested = false;
+    stats.restarts++;
+    heating.reset(new SmarthataHeating(ssid, pass));
+}
+
+/**
+ * Serves a pseudo-random image of the given size, with a wrong checksum if corrupt.
+ */
+static void serveFirmware(size_t size, bool corrupt) {
+    nativeHal().firmwareImage.resize(size);
+    uint32_t seed = 12345;
+    for (uint8_t &b : nativeHal().firmwareImage) {
+        seed = seed * 1103515245 + 12345;
+        b = static_cast<uint8_t>(seed >> 16);
+    }
+    MD5Builder md5;
+    md5.begin();
+    md5.add(nativeHal().firmwareImage.data(), size);
+    md5.calculate();
+    nativeHal().firmwareMd5 = md5.toString();
+    if (corrupt) nativeHal().firmwareImage[size / 2] ^= 0xFF;
+}
+
+static void printRow(const ThermalPlant &plant, unsigned long now) {
+    printf("%6.2f\t%6.2f\t%6.2f\t%6.2f\t%6.2f\t%6.2f\t%6.2f\t%5.1f\t%6.2f\t%d\n",
+           now / (float) HOUR_MS, plant.streetTemp, plant.boilerTemp, plant.mixedTemp, plant.floorColdTemp,
+           plant.slabTemp, plant.roomTemp, plant.valvePosition * 100, stats.floorCorrected, plant.batteryPomp);
+}
+
+int main(int argc, char **argv) {
+    float days = 7;
+    unsigned long stepMs = 100;
+    bool csv = false;
+    float brokerDownFrom = -1;
+    float brokerDownTo = -1;
+    float replaceStreetAt = -1;
+    float restartAt = -1;
+    float otaAt = -1;
+    float sensorFailAt = -1;
+    int sensorFailRole = -1;
+    float glitchEvery = 0;
+    float roomQuietFrom = -1;
+    float roomQuietTo = -1;
+    bool otaCorrupt = false;
+    const char *replayPath = nullptr;
+    // a run missing one of these exits with 3, fault scenarios pass their own limits
+    float maxFloorError = 0.5f;
+    float maxRoomError = 0.5f;
+    float minReplayMatch = 95;
+    std::vector<float> scrapes;
+    std::vector<std::shared_ptr<NativeConnection>> pendingScrapes;
+    std::vector<ScheduledMessage> scheduled;
+    ThermalPlant plant = ThermalPlant(RELAY_MIXER_UP_PIN, RELAY_MIXER_DOWN_PIN, RELAY_BATTERY_POMP_PIN);
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) days = strtof(argv[++i], nullptr);
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) stepMs = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--street") == 0 && i + 1 < argc) plant.streetMean = strtof(argv[++i], nullptr);
+        else if (strcmp(argv[i], "--broker-down") == 0 && i + 2 < argc) {
+            brokerDownFrom = strtof(argv[++i], nullptr);
+            brokerDownTo = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--replace-street") == 0 && i + 1 < argc) {
+            replaceStreetAt = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--restart") == 0 && i + 1 < argc) {
+            restartAt = strtof(argv[++i], nullptr);
+        } else if ((strcmp(argv[i], "--ota") == 0 || strcmp(argv[i], "--ota-corrupt") == 0) && i + 1 < argc) {
+            otaCorrupt = strcmp(argv[i], "--ota-corrupt") == 0;
+            otaAt = strtof(argv[++i], nullptr);
+            scheduled.push_back({static_cast<unsigned long>(otaAt * HOUR_MS), "/heating/floor/in", "update"});
+        } else if (strcmp(argv[i], "--sensor-fail") == 0 && i + 2 < argc) {
+            sensorFailAt = strtof(argv[++i], nullptr);
+            sensorFailRole = SensorRegistry::findRole(argv[++i]);
+        } else if (strcmp(argv[i], "--room-quiet") == 0 && i + 2 < argc) {
+            roomQuietFrom = strtof(argv[++i], nullptr);
+            roomQuietTo = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--read-errors") == 0 && i + 1 < argc) {
+            nativeHal().sensorReadErrorPercent = static_cast<uint8_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--glitch") == 0 && i + 1 < argc) {
+            glitchEvery = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--mqtt") == 0 && i + 3 < argc) {
+            unsigned long at = static_cast<unsigned long>(strtof(argv[i + 1], nullptr) * HOUR_MS);
+            scheduled.push_back({at, argv[i + 2], argv[i + 3]});
+            i += 3;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 2 < argc) {
+            unsigned long at = static_cast<unsigned long>(strtof(argv[++i], nullptr) * HOUR_MS);
+            // hour 0 records from boot, the only start a replay reproduces exactly
+            if (at == 0) inputRecorder.start();
+            else scheduled.push_back({at, InputRecorder::CONTROL_TOPIC, "on"});
+            recording = fopen(argv[++i], "w");
+        } else if (strcmp(argv[i], "--scrape") == 0 && i + 1 < argc) {
+            scrapes.push_back(strtof(argv[++i], nullptr));
+        } else if (strcmp(argv[i], "--check-frames") == 0 && i + 1 < argc) {
+            unsigned long frames = strtoul(argv[++i], nullptr, 10);
+            bool passed = FrameCheck::run(frames, TelemetryFrame::ALL_FIELDS) &&
+                          FrameCheck::run(frames, 1UL << FLOOR_CORRECTED | 1UL << MIXED | 1UL << COLD);
+            return passed ? 0 : 1;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--max-floor-error") == 0 && i + 1 < argc) {
+            maxFloorError = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--max-room-error") == 0 && i + 1 < argc) {
+            maxRoomError = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--min-replay-match") == 0 && i + 1 < argc) {
+            minReplayMatch = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--csv") == 0) csv = true;
+        else if (strcmp(argv[i], "--verbose") == 0) nativeHal().serialEcho = true;
+        else {
+            printf("usage: %s [--days N] [--step MS] [--street TEMP] [--broker-down HOUR HOUR] [--replace-street HOUR]\n       [--restart HOUR] [--ota HOUR] [--ota-corrupt HOUR]\n       [--sensor-fail HOUR ROLE] [--read-errors PERCENT] [--glitch MINUTES] [--room-quiet HOUR HOUR]\n       [--mqtt HOUR TOPIC PAYLOAD]... [--record HOUR FILE] [--replay FILE]\n       [--scrape HOUR]... [--csv] [--verbose]\n       [--max-floor-error C] [--max-room-error C] [--min-replay-match PERCENT]\n       %s --check-frames N\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    const uint8_t addresses[6][8] = {
+            {0x28, 0x61, 0xBF, 0x3A, 0x06, 0x00, 0x00, 0x48},
+            {0x28, 0x55, 0x8A, 0xCC, 0x06, 0x00, 0x00, 0x57},
+            {0x28, 0x6F, 0xE8, 0xCA, 0x06, 0x00, 0x00, 0xEE},
+            {0x28, 0xC2, 0x6E, 0xCB, 0x06, 0x00, 0x00, 0x20},
+            {0x28, 0xD4, 0xD3, 0xE1, 0x06, 0x00, 0x00, 0x01},
+            {0x28, 0xFF, 0x98, 0x3A, 0x91, 0x16, 0x04, 0x36},
+    };
+    NativeSensor *sensors[6];
+    for (int i = 0; i < 6; ++i) {
+        sensors[i] = &nativeHal().addSensor(addresses[i], 20);
+    }
+    updateSensors(plant, sensors);
+    nativeHal().onMqttPublish = onMqttPublish;
+
+    if (replayPath != nullptr) {
+        Replayer replayer;
+        if (!replayer.load(replayPath)) return 1;
+        double matched = replayer.run(sensors, stepMs);
+        if (matched < minReplayMatch) {
+            printf("check failed: replay matched %.1f%% < %.1f%%\n", matched, minReplayMatch);
+            return 3;
+        }
+        return 0;
+    }
+
+    nativeHal().firmwareUrl = firmware;
+    if (otaAt >= 0) serveFirmware(400 * 1024, otaCorrupt);
+
+    auto started = std::chrono::steady_clock::now();
+    std::unique_ptr<SmarthataHeating> heating(new SmarthataHeating(ssid, pass));
+
+    if (csv) printf("hour\tstreet\tboiler\tmixed\tcold\tslab\troom\tvalve\tcorrected\tpomp\n");
+
+    const unsigned long duration = static_cast<unsigned long>(days * DAY_MS);
+    unsigned long nextMqtt = 0;
+    unsigned long nextRow = 0;
+    while (millis() < duration) {
+        unsigned long now = millis();
+        plant.step(now);
+        if (replaceStreetAt >= 0 && now >= replaceStreetAt * HOUR_MS) {
+            const uint8_t replacement[8] = {0x28, 0xAA, 0x12, 0x34, 0x56, 0x78, 0x9A, 0x31};
+            sensors[5]->connected = false;
+            sensors[5] = &nativeHal().addSensor(replacement, plant.streetTemp);
+            replaceStreetAt = -1;
+        }
+        nativeHal().mqttBrokerUp = now < brokerDownFrom * HOUR_MS || now >= brokerDownTo * HOUR_MS;
+        updateSensors(plant, sensors);
+        if (sensorFailRole >= 0 && now >= sensorFailAt * HOUR_MS) {
+            sensors[sensorFailRole]->connected = false;
+        }
+        if (glitchEvery > 0 && now % static_cast<unsigned long>(glitchEvery * MINUTE_MS) < stepMs) {
+            // DS18B20 power-on reset value
+            sensors[now / stepMs % 6]->temp = 85.0f;
+        }
+        for (ScheduledMessage &message : scheduled) {
+            if (message.topic != nullptr && now >= message.at) {
+                nativeHal().mqttDeliver(message.topic, message.payload);
+                message.topic = nullptr;
+            }
+        }
+        if (now >= nextMqtt) {
+            deliverMqtt(plant, now, now < roomQuietFrom * HOUR_MS || now >= roomQuietTo * HOUR_MS);
+            nextMqtt = now + MINUTE_MS;
+        }
+
+        for (float &at : scrapes) {
+            if (at >= 0 && now >= at * HOUR_MS) {
+                pendingScrapes.push_back(nativeHal().connect(StatusServer::PORT, "GET /metrics HTTP/1.1\r\nHost: heating\r\n\r\n"));
+                at = -1;
+            }
+        }
+        for (auto it = pendingScrapes.begin(); it != pendingScrapes.end();) {
+            if ((*it)->open) {
+                ++it;
+                continue;
+            }
+            printf("scrape at %.2f h:\n%s", now / (float) HOUR_MS, (*it)->response.c_str());
+            it = pendingScrapes.erase(it);
+        }
+
+        heating->loop();
+        if (nativeHal().restartRequested || (restartAt >= 0 && now >= restartAt * HOUR_MS)) {
+            if (!nativeHal().restartRequested) restartAt = -1;
+            restart(heating);
+        }
+
+        if (plant.valvePosition > 0 && plant.valvePosition < 1 &&
+            nativeHal().pins[RELAY_MIXER_UP_PIN] != nativeHal().pins[RELAY_MIXER_DOWN_PIN]) {
+            stats.valveMovingMs += stepMs;
+        }
+        if (plant.batteryPomp) stats.pompOnMs += stepMs;
+        if (now >= nextRow) {
+            stats.samples++;
+            stats.roomSum += plant.roomTemp;
+            stats.roomMin = min(stats.roomMin, plant.roomTemp);
+            stats.roomMax = max(stats.roomMax, plant.roomTemp);
+            float roomError = plant.roomTemp - (RADIATOR_ZONES[0].normalTemp + weeklySchedule.value(RADIATOR_ZONES[0].schedule));
+            stats.roomErrorSum += fabs(roomError);
+            stats.roomOvershootMax = max(stats.roomOvershootMax, roomError);
+            if (now >= DAY_MS && !std::isnan(stats.floorCorrected)) {
+                stats.floorErrorSum += fabs((plant.mixedTemp + plant.floorColdTemp) * 0.5f - stats.floorCorrected);
+                stats.floorErrorSamples++;
+            }
+            if (csv && now % HOUR_MS < MINUTE_MS) printRow(plant, now);
+            nextRow = now + MINUTE_MS;
+        }
+
+        delay(stepMs);
+    }
+
+    if (recording != nullptr) fclose(recording);
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    printf("simulated %.1f days in %.2f s (x%.0f)\n", days, wall, duration / 1000.0 / max(wall, 1e-6));
+    printf("room temp: mean %.2f, min %.2f, max %.2f\n", stats.roomSum / max(stats.samples, 1UL), stats.roomMin,
+           stats.roomMax);
+    printf("room vs schedule: mean error %.2f, max overshoot %.2f\n", stats.roomErrorSum / max(stats.samples, 1UL),
+           stats.roomOvershootMax);
+    printf("floor medium temp error after first day: %.2f\n",
+           stats.floorErrorSamples ? stats.floorErrorSum / stats.floorErrorSamples : 0.0);
+    printf("backlog records replayed %lu, restarts %lu, firmware flashed %s\n", stats.backlogRecords, stats.restarts,
+           nativeHal().firmwareFlashed ? "yes" : "no");
+    printf("valve moving %.1f%%, battery pomp on %.1f%%, mqtt publishes %lu, http requests %lu, messages %lu\n",
+           100.0 * stats.valveMovingMs / duration, 100.0 * stats.pompOnMs / duration,
+           nativeHal().mqttPublished, nativeHal().httpRequests, stats.messages);
+    printf("mqtt bytes published %lu, telemetry frames refused %lu, sensor read errors %lu\n",
+           nativeHal().mqttPublishedBytes, stats.framesRefused, nativeHal().sensorReadErrors);
+
+    bool passed = true;
+    double roomError = stats.roomErrorSum / max(stats.samples, 1UL);
+    if (roomError > maxRoomError) {
+        printf("check failed: room mean error %.2f > %.2f\n", roomError, maxRoomError);
+        passed = false;
+    }
+    if (stats.floorErrorSamples > 0 && stats.floorErrorSum / stats.floorErrorSamples > maxFloorError) {
+        printf("check failed: floor error after the first day %.2f > %.2f\n",
+               stats.floorErrorSum / stats.floorErrorSamples, maxFloorError);
+        passed = false;
+    }
+    return passed ? 0 : 3;
+}
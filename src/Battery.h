@@ -1,55 +1,240 @@
 #ifndef SMARTHATA_HEATING_BATTERY_H
 #define SMARTHATA_HEATING_BATTERY_H
 
+#include "Zones.h"
+#include "Log.h"
+
+/**
+ * Radiator pump of one zone. Learns how fast the room heats with the pump on, how fast it cools
+ * with the pump off and how much it keeps rising after the pump stops, then stops the pump
+ * that much early and moves to the next scheduled temperature as soon as reaching it takes
+ * the remaining time. When the room temperature is stale the pump runs a fixed cycle
+ * with the learned duty.
+ */
 class Battery {
 
 public:
 
-    static constexpr float NORMAL_TEMP = 21.0f;
     static constexpr float BORDER = 0.2f;
 
-    float expectedBedroomTemp = NORMAL_TEMP;
-    //                        12 1  2  3  4  5  6  7  8  9 10 11
-    int8_t corrections[24] = {0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3,
-                              3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2};
+    static const unsigned long STALE_MS = 15 * 60000UL;
+    static const unsigned long FALLBACK_PERIOD_MS = 30 * 60000UL;
+    static constexpr float FALLBACK_DUTY_MIN = 0.05f;
+    static constexpr float FALLBACK_DUTY_MAX = 0.6f;
+
+    static const unsigned long SEGMENT_MIN_MS = 10 * 60000UL;
+    static const unsigned long COAST_WINDOW_MS = 60 * 60000UL;
+    static constexpr float LEARN_ALPHA = 0.2f;
+    static constexpr float DUTY_ALPHA = 0.02f;
+    static const int LEAD_MAX_MIN = 6 * 60;
 
-    Battery() {
+    float expectedRoomTemp;
+    float targetTemp;
+
+    Battery(const RadiatorZoneConfig &zone, byte index) :
+            expectedRoomTemp(zone.normalTemp), targetTemp(zone.normalTemp),
+            zone(zone), room(mqttUpdate.rooms[index]), batteryRelay(zone.pumpPin) {
         batteryRelay.disable();
     }
 
     void loop() {
+        unsigned long now = millis();
+        if (batteryRelay.isEnabled()) onMs += now - lastLoopAt;
+        lastLoopAt = now;
 
-        expectedBedroomTemp = calcExpectedBedroomTemp();
-
-        if (TemperatureSensors::isValidTemp(mqttUpdate.bedroomTemp)) {
+        expectedRoomTemp = calcExpectedRoomTemp();
 
-            if (batteryRelay.isEnabled()) {
-                if (mqttUpdate.bedroomTemp >= expectedBedroomTemp /*|| th.heatingHotTemp < th.batteryColdTemp*/) {
-                    batteryRelay.disable();
-                }
-            } else {
-                if (mqttUpdate.bedroomTemp <= expectedBedroomTemp - BORDER) {
-                    batteryRelay.enable();
-                }
+        if (isStale()) {
+            if (!stale) {
+                stale = true;
+                staleSince = now;
+                segmentValid = false;
+                coastTracking = false;
+                LOG_WARN(BATTERY, "%s temperature is stale, running fixed cycle", zone.name);
             }
+            float duty = constrain(dutyMean, FALLBACK_DUTY_MIN, FALLBACK_DUTY_MAX);
+            setPump((now - staleSince) % FALLBACK_PERIOD_MS < duty * FALLBACK_PERIOD_MS, now);
+            return;
+        }
+        stale = false;
+
+        float temp = room.temp;
+        if (room.updatedAt != sampleAt) {
+            sampleAt = room.updatedAt;
+            learn(temp, now);
         }
-    }
 
-    float calcExpectedBedroomTemp() const {
-        if (mqttUpdate.secondOfDay >= 0) {
-            byte hourOfDay = static_cast<byte>(mqttUpdate.secondOfDay / 3600);
-            return NORMAL_TEMP + corrections[hourOfDay];
+        targetTemp = plannedTarget(temp);
+        float coastShare = coast < BORDER * 0.75f ? coast : BORDER * 0.75f;
+        if (batteryRelay.isEnabled()) {
+            if (temp >= targetTemp - coastShare) setPump(false, now);
+        } else {
+            if (temp <= targetTemp - BORDER) setPump(true, now);
         }
-        return NORMAL_TEMP;
     }
 
-    int getBatteryPompState() {
+    float calcExpectedRoomTemp() const {
+        return zone.normalTemp + weeklySchedule.value(zone.schedule);
+    }
+
+    bool isStale() const {
+        return !TemperatureSensors::isValidTemp(room.temp) || millis() - room.updatedAt >= STALE_MS;
+    }
+
+    float getRoomTemp() const {
+        return room.temp;
+    }
+
+    const char *getName() const {
+        return zone.name;
+    }
+
+    int getBatteryPompState() const {
         return batteryRelay.isEnabled() ? 10 : 0;
     }
 
+    bool isPumpOn() const {
+        return batteryRelay.isEnabled();
+    }
+
+    /**
+     * Writes duty statistics since the previous call as JSON and starts a new window.
+     */
+    void takeStats(char *out, size_t size) {
+        unsigned long now = millis();
+        if (batteryRelay.isEnabled()) onMs += now - lastLoopAt;
+        lastLoopAt = now;
+
+        unsigned long window = now - windowStart;
+        float duty = window > 0 ? static_cast<float>(onMs) / window : 0;
+        if (!stale && window > 0) dutyMean += DUTY_ALPHA * (duty - dutyMean);
+
+        snprintf(out, size, "{\"zone\":\"%s\",\"duty\":%.3f,\"duty-mean\":%.3f,\"cycles\":%u,\"on-avg-sec\":%lu,"
+                            "\"heat-rate\":%.2f,\"cool-rate\":%.2f,\"coast\":%.2f,\"target\":%.2f,\"stale\":%d}",
+                 zone.name, duty, dutyMean, cycles, cycles > 0 ? onMs / cycles / 1000 : onMs / 1000,
+                 heatRate, coolRate, coast, targetTemp, stale ? 1 : 0);
+
+        windowStart = now;
+        onMs = 0;
+        cycles = 0;
+    }
+
 private:
 
-    Relay batteryRelay = Relay(RELAY_BATTERY_POMP_PIN);
+    const RadiatorZoneConfig &zone;
+    const RoomUpdate &room;
+    Relay batteryRelay;
+
+    // learned room response, degrees per hour and degrees
+    float heatRate = 0.5f;
+    float coolRate = 0.3f;
+    float coast = 0.1f;
+    float dutyMean = 0.2f;
+
+    int plannedTransition = -1;
+    unsigned long sampleAt = 0;
+    bool stale = false;
+    unsigned long staleSince = 0;
+
+    bool segmentValid = false;
+    unsigned long segmentStartAt = 0;
+    float segmentStartTemp = 0;
+
+    bool coastTracking = false;
+    unsigned long coastStartAt = 0;
+    float coastStartTemp = 0;
+    float coastPeak = 0;
+
+    unsigned long lastLoopAt = 0;
+    unsigned long windowStart = 0;
+    unsigned long onMs = 0;
+    unsigned int cycles = 0;
+
+    /**
+     * Moves to the next scheduled temperature once the learned rate needs the remaining time
+     * to reach it, and stays there until the transition so the pump does not chatter.
+     */
+    float plannedTarget(float temp) {
+        float next = 0;
+        int minutes = weeklySchedule.minutesToNext(zone.schedule, next);
+        if (minutes < 0) return expectedRoomTemp;
+
+        int transition = static_cast<int>((localClock.minuteOfWeek() + minutes) % LocalClock::MINUTES_PER_WEEK);
+        float nextTarget = zone.normalTemp + next;
+        if (transition == plannedTransition) return nextTarget;
+
+        float lead = 0;
+        if (nextTarget > expectedRoomTemp && heatRate > 0) {
+            lead = (nextTarget - temp) / heatRate * 60;
+        } else if (nextTarget < expectedRoomTemp && coolRate > 0) {
+            lead = (temp - nextTarget) / coolRate * 60;
+        }
+        if (lead > LEAD_MAX_MIN) lead = LEAD_MAX_MIN;
+        if (minutes > lead) return expectedRoomTemp;
+
+        plannedTransition = transition;
+        return nextTarget;
+    }
+
+    void learn(float temp, unsigned long now) {
+        if (!segmentValid) {
+            segmentValid = true;
+            segmentStartAt = now;
+            segmentStartTemp = temp;
+        }
+
+        if (coastTracking) {
+            if (temp > coastPeak) coastPeak = temp;
+            if (temp < coastPeak - 0.1f || now - coastStartAt >= COAST_WINDOW_MS) {
+                finishCoast();
+                // cooling is measured from the end of the coast
+                segmentStartAt = now;
+                segmentStartTemp = temp;
+            }
+        }
+    }
+
+    void setPump(bool on, unsigned long now) {
+        if (on == batteryRelay.isEnabled()) return;
+
+        if (!stale) {
+            float temp = room.temp;
+            closeSegment(temp, now);
+            if (on) {
+                if (coastTracking) finishCoast();
+            } else {
+                coastTracking = true;
+                coastStartAt = now;
+                coastStartTemp = coastPeak = temp;
+            }
+            segmentValid = true;
+            segmentStartAt = now;
+            segmentStartTemp = temp;
+        }
+
+        if (on) {
+            batteryRelay.enable();
+            cycles++;
+        } else {
+            batteryRelay.disable();
+        }
+    }
+
+    void closeSegment(float temp, unsigned long now) {
+        if (!segmentValid || now - segmentStartAt < SEGMENT_MIN_MS) return;
+        float rate = (temp - segmentStartTemp) * 3600000.0f / (now - segmentStartAt);
+        if (batteryRelay.isEnabled()) {
+            if (rate > 0) heatRate += LEARN_ALPHA * (rate - heatRate);
+        } else {
+            if (rate < 0) coolRate += LEARN_ALPHA * (-rate - coolRate);
+        }
+    }
+
+    void finishCoast() {
+        coastTracking = false;
+        float rise = coastPeak - coastStartTemp;
+        coast += LEARN_ALPHA * (constrain(rise, 0.0f, 1.0f) - coast);
+    }
 
 };
 
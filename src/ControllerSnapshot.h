@@ -0,0 +1,118 @@
+#ifndef SMARTHATA_HEATING_CONTROLLERSNAPSHOT_H
+#define SMARTHATA_HEATING_CONTROLLERSNAPSHOT_H
+
+#include <FS.h>
+#include <OneWire.h>
+#include "Zones.h"
+
+struct ControllerState {
+    uint32_t magic;
+    uint32_t seq;
+    int32_t valvePositionMs;
+    int32_t valveUncertaintyMs;
+    int32_t valveTravelMs;
+    float innerIntegral;
+    float outerIntegral;
+    int16_t floorTemp;
+    int16_t mixedSetpoint;
+    int16_t temps[6];
+    uint8_t reserved[3];
+    uint8_t crc;
+};
+
+static_assert(sizeof(ControllerState) == 48, "ControllerState must stay 48 bytes");
+
+/**
+ * Warm-restart snapshots of one floor zone's controller state. Snapshots go round-robin into SLOTS
+ * fixed slots of one file, so consecutive writes land on different flash pages,
+ * and boot restores the valid slot with the highest sequence number.
+ */
+class ControllerSnapshot {
+public:
+    static const byte SLOTS = 8;
+
+private:
+    static const uint32_t MAGIC = 0x53544131;
+
+    char path[16]{};
+    bool mounted = false;
+    uint32_t seq = 0;
+
+public:
+
+    /**
+     * @return true when a valid snapshot was found and copied to state
+     */
+    bool begin(byte zone, ControllerState &state) {
+        zoneFilePath(path, sizeof(path), "state", zone);
+        mounted = SPIFFS.begin();
+        if (!mounted) return false;
+
+        File file = SPIFFS.open(path, "r");
+        if (!file || file.size() != SLOTS * sizeof(ControllerState)) {
+            if (file) file.close();
+            format();
+            return false;
+        }
+
+        bool found = false;
+        ControllerState slot{};
+        for (byte i = 0; i < SLOTS; ++i) {
+            file.seek(static_cast<uint32_t>(i) * sizeof(ControllerState), SeekSet);
+            if (file.read(reinterpret_cast<uint8_t *>(&slot), sizeof(ControllerState)) != sizeof(ControllerState)) break;
+            if (!isValid(slot)) continue;
+            if (!found || slot.seq > state.seq) {
+                state = slot;
+                found = true;
+            }
+        }
+        file.close();
+
+        if (found) seq = state.seq + 1;
+        return found;
+    }
+
+    void save(ControllerState &state) {
+        if (!mounted) return;
+        state.magic = MAGIC;
+        state.seq = seq;
+        memset(state.reserved, 0, sizeof(state.reserved));
+        state.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&state), offsetof(ControllerState, crc));
+
+        File file = SPIFFS.open(path, "r+");
+        if (!file) return;
+        file.seek(static_cast<uint32_t>(seq % SLOTS) * sizeof(ControllerState), SeekSet);
+        file.write(reinterpret_cast<const uint8_t *>(&state), sizeof(ControllerState));
+        file.close();
+        seq++;
+    }
+
+    uint32_t getSeq() const {
+        return seq;
+    }
+
+private:
+
+    void format() {
+        File file = SPIFFS.open(path, "w");
+        if (!file) {
+            mounted = false;
+            return;
+        }
+        ControllerState empty{};
+        for (byte i = 0; i < SLOTS; ++i) {
+            file.write(reinterpret_cast<const uint8_t *>(&empty), sizeof(ControllerState));
+        }
+        file.close();
+    }
+
+    static bool isValid(const ControllerState &state) {
+        return state.magic == MAGIC
+               && state.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&state), offsetof(ControllerState, crc))
+               && state.valveTravelMs >= 30000 && state.valveTravelMs <= 600000
+               && state.valvePositionMs >= 0 && state.valvePositionMs <= state.valveTravelMs
+               && state.valveUncertaintyMs >= 0;
+    }
+};
+
+#endif
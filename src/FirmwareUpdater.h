@@ -0,0 +1,149 @@
+#ifndef SMARTHATA_HEATING_FIRMWAREUPDATER_H
+#define SMARTHATA_HEATING_FIRMWAREUPDATER_H
+
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#include <Updater.h>
+
+/**
+ * Streaming OTA update. start() only sends the request, loop() moves at most
+ * CHUNKS_PER_TICK chunks from the HTTP stream to the update partition, so the rest of
+ * the loop keeps running during the download. The image is checked against the x-MD5
+ * header in commit(), which the caller invokes once the relays are in a safe state.
+ */
+class FirmwareUpdater {
+public:
+
+    enum State {
+        UPDATE_IDLE, UPDATE_DOWNLOADING, UPDATE_DOWNLOADED, UPDATE_DONE, UPDATE_FAILED
+    };
+
+    static const size_t CHUNK_SIZE = 512;
+    static const byte CHUNKS_PER_TICK = 2;
+    static const unsigned long STALL_TIMEOUT_MS = 30000;
+
+private:
+
+    WiFiClient client;
+    HTTPClient http;
+    WiFiClient *stream = nullptr;
+
+    State state = UPDATE_IDLE;
+    const char *error = "";
+    size_t total = 0;
+    size_t written = 0;
+    unsigned long lastDataAt = 0;
+
+    uint8_t chunk[CHUNK_SIZE]{};
+
+public:
+
+    bool start(const char *url) {
+        if (state == UPDATE_DOWNLOADING || state == UPDATE_DOWNLOADED) return false;
+        written = 0;
+        total = 0;
+
+        const char *headers[] = {"x-MD5"};
+        http.begin(client, url);
+        http.setTimeout(5000);
+        http.collectHeaders(headers, 1);
+
+        int code = http.GET();
+        if (code != 200) return fail(code == 304 ? "no update" : "request failed");
+
+        int size = http.getSize();
+        if (size <= 0) return fail("unknown size");
+        total = static_cast<size_t>(size);
+
+        String md5 = http.header("x-MD5");
+        if (md5.length() != 32) return fail("no checksum");
+
+        if (!Update.begin(total)) return fail("not enough space");
+        Update.setMD5(md5.c_str());
+
+        stream = http.getStreamPtr();
+        lastDataAt = millis();
+        state = UPDATE_DOWNLOADING;
+        return true;
+    }
+
+    void loop() {
+        if (state != UPDATE_DOWNLOADING) return;
+
+        for (byte i = 0; i < CHUNKS_PER_TICK && written < total; ++i) {
+            size_t available = static_cast<size_t>(stream->available());
+            if (available == 0) break;
+
+            size_t length = available < CHUNK_SIZE ? available : CHUNK_SIZE;
+            if (length > total - written) length = total - written;
+            length = stream->readBytes(chunk, length);
+            if (Update.write(chunk, length) != length) {
+                fail("flash write failed");
+                return;
+            }
+            written += length;
+            lastDataAt = millis();
+        }
+
+        if (written == total) {
+            http.end();
+            state = UPDATE_DOWNLOADED;
+        } else if (millis() - lastDataAt >= STALL_TIMEOUT_MS) {
+            fail("download stalled");
+        }
+    }
+
+    /**
+     * Verifies the checksum and marks the new image for boot.
+     * @return true when the device can be restarted into the new firmware
+     */
+    bool commit() {
+        if (state != UPDATE_DOWNLOADED) return false;
+        if (!Update.end()) return fail("checksum mismatch");
+        state = UPDATE_DONE;
+        return true;
+    }
+
+    /**
+     * Returns to idle after a failure has been reported.
+     */
+    void reset() {
+        if (!isBusy()) state = UPDATE_IDLE;
+    }
+
+    State getState() const {
+        return state;
+    }
+
+    bool isBusy() const {
+        return state == UPDATE_DOWNLOADING || state == UPDATE_DOWNLOADED;
+    }
+
+    const char *getError() const {
+        return error;
+    }
+
+    size_t getWritten() const {
+        return written;
+    }
+
+    size_t getTotal() const {
+        return total;
+    }
+
+    byte getProgress() const {
+        return total > 0 ? static_cast<byte>(100ULL * written / total) : 0;
+    }
+
+private:
+
+    bool fail(const char *reason) {
+        if (Update.isRunning()) Update.end();
+        http.end();
+        error = reason;
+        state = UPDATE_FAILED;
+        return false;
+    }
+};
+
+#endif
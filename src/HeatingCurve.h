@@ -0,0 +1,167 @@
+#ifndef SMARTHATA_HEATING_HEATINGCURVE_H
+#define SMARTHATA_HEATING_HEATINGCURVE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <OneWire.h>
+#include "Zones.h"
+#include "Log.h"
+
+/**
+ * Weather-compensation curve: floor temperature offset by street temperature, given as up to
+ * POINTS_MAX points and flat beyond the first and the last one. The points are compiled into
+ * a table of centidegrees with one entry per half degree of street temperature, so
+ * an evaluation is a single lookup. The points are kept in SPIFFS.
+ */
+class HeatingCurve {
+public:
+
+    static const byte POINTS_MAX = 8;
+    static const int STREET_MIN = -40;
+    static const int STREET_MAX = 30;
+    static const byte TABLE_SIZE = (STREET_MAX - STREET_MIN) * 2 + 1;
+
+    struct Point {
+        int8_t street;
+        int16_t offsetCenti;
+    };
+
+private:
+
+    static const uint32_t MAGIC = 0x48435631;
+
+    struct Stored {
+        uint32_t magic;
+        byte count;
+        Point points[POINTS_MAX];
+        uint8_t crc;
+    };
+
+    // matches the former linear curve: -0.3 per degree of street temperature
+    Point points[POINTS_MAX] = {{STREET_MIN, 1200}, {STREET_MAX, -900}};
+    byte count = 2;
+
+    int16_t table[TABLE_SIZE]{};
+    char path[16]{};
+
+public:
+
+    void begin(byte zone) {
+        zoneFilePath(path, sizeof(path), "curve", zone);
+        if (SPIFFS.begin() && load()) {
+            LOG_INFO(MIXER, "HeatingCurve: loaded");
+        }
+        compile();
+    }
+
+    float offset(float streetTemp) const {
+        int index = static_cast<int>((streetTemp - STREET_MIN) * 2 + 0.5f);
+        if (index < 0) index = 0;
+        if (index >= TABLE_SIZE) index = TABLE_SIZE - 1;
+        return table[index] * 0.01f;
+    }
+
+    /**
+     * Payload is "street:offset" pairs separated by spaces with street temperatures ascending,
+     * e.g. "-20:6 0:0 15:-4.5".
+     * @return false when the payload is malformed, the curve is unchanged then
+     */
+    bool configure(const char *payload) {
+        Point parsed[POINTS_MAX];
+        byte parsedCount = 0;
+        const char *p = payload;
+        while (*p) {
+            while (*p == ' ' || *p == ',' || *p == ';') p++;
+            if (*p == '\0') break;
+            if (parsedCount >= POINTS_MAX) return false;
+
+            char *end;
+            long street = strtol(p, &end, 10);
+            if (end == p || *end != ':' || street < STREET_MIN || street > STREET_MAX) return false;
+            if (parsedCount > 0 && street <= parsed[parsedCount - 1].street) return false;
+            p = end + 1;
+            float value = strtof(p, &end);
+            if (end == p || value < -30 || value > 30) return false;
+            p = end;
+
+            parsed[parsedCount].street = static_cast<int8_t>(street);
+            parsed[parsedCount].offsetCenti = static_cast<int16_t>(lroundf(value * 100));
+            parsedCount++;
+        }
+        if (parsedCount == 0) return false;
+
+        memcpy(points, parsed, sizeof(Point) * parsedCount);
+        count = parsedCount;
+        compile();
+        save();
+        return true;
+    }
+
+    void print(char *out, size_t size) const {
+        size_t length = 0;
+        out[0] = '\0';
+        for (byte i = 0; i < count && length < size; ++i) {
+            int centi = points[i].offsetCenti;
+            int written = snprintf(out + length, size - length, "%s%d:%s%d.%02d", i > 0 ? " " : "",
+                                   points[i].street, centi < 0 ? "-" : "", abs(centi) / 100, abs(centi) % 100);
+            if (written < 0) break;
+            length += written;
+        }
+    }
+
+private:
+
+    void compile() {
+        for (byte i = 0; i < TABLE_SIZE; ++i) {
+            // street temperature in half degrees
+            int street = STREET_MIN * 2 + i;
+            table[i] = interpolate(street);
+        }
+    }
+
+    int16_t interpolate(int streetHalf) const {
+        if (streetHalf <= points[0].street * 2) return points[0].offsetCenti;
+        for (byte i = 1; i < count; ++i) {
+            int x0 = points[i - 1].street * 2;
+            int x1 = points[i].street * 2;
+            if (streetHalf <= x1) {
+                long y0 = points[i - 1].offsetCenti;
+                long y1 = points[i].offsetCenti;
+                long dy = (y1 - y0) * (streetHalf - x0);
+                long dx = x1 - x0;
+                return static_cast<int16_t>(y0 + (dy >= 0 ? dy + dx / 2 : dy - dx / 2) / dx);
+            }
+        }
+        return points[count - 1].offsetCenti;
+    }
+
+    bool load() {
+        File file = SPIFFS.open(path, "r");
+        if (!file) return false;
+        Stored stored{};
+        bool valid = file.read(reinterpret_cast<uint8_t *>(&stored), sizeof(Stored)) == sizeof(Stored)
+                     && stored.magic == MAGIC
+                     && stored.count > 0 && stored.count <= POINTS_MAX
+                     && stored.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        file.close();
+        if (valid) {
+            memcpy(points, stored.points, sizeof(points));
+            count = stored.count;
+        }
+        return valid;
+    }
+
+    void save() {
+        Stored stored{};
+        stored.magic = MAGIC;
+        stored.count = count;
+        memcpy(stored.points, points, sizeof(points));
+        stored.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        File file = SPIFFS.open(path, "w");
+        if (!file) return;
+        file.write(reinterpret_cast<const uint8_t *>(&stored), sizeof(Stored));
+        file.close();
+    }
+};
+
+#endif
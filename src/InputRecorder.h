@@ -0,0 +1,270 @@
+#ifndef SMARTHATA_HEATING_INPUTRECORDER_H
+#define SMARTHATA_HEATING_INPUTRECORDER_H
+
+#include <Arduino.h>
+#include "ControllerSnapshot.h"
+#include "SensorRegistry.h"
+#include "WeeklySchedule.h"
+
+enum InputEntryType : byte {
+    INPUT_SENSOR = 1,
+    INPUT_MQTT = 2,
+    INPUT_OUTPUTS = 3,
+    INPUT_STATE = 4,
+};
+
+/**
+ * Records the controller inputs, changes of the raw DS18B20 readings and inbound MQTT messages, with the
+ * relay outputs they led to, so a field run can be replayed on the host. Entries go into
+ * a RAM block; a full block is sealed and the next one filled while it waits to be published
+ * as "<seq> <hex>" on /heating/recorder. Entries that find both blocks full are dropped, so are
+ * messages longer than any route takes, all of them are counted in getDropped(). Blocks
+ * published while offline are lost, a gap in seq shows it. A block is a uint32 millis() at its
+ * start followed by entries: varint ms since the previous entry, type, then
+ * - INPUT_SENSOR: role, int16 reading in 1/128 C, exact for every DS18B20 resolution
+ * - INPUT_MQTT: topic length, topic, payload length, payload
+ * - INPUT_OUTPUTS: uint16 relay mask
+ * - INPUT_STATE: zone, ControllerState
+ */
+class InputRecorder {
+public:
+
+    // the longest inbound topic, a zone topic, and the longest payload a route takes, a schedule
+    static const size_t MQTT_TOPIC_MAX = 31;
+    static const size_t MQTT_PAYLOAD_MAX = WeeklySchedule::BLOB_SIZE - 1;
+    // an empty block takes the largest message: delta, type, topic and payload with their lengths
+    static const size_t BLOCK_SIZE = 4 + 1 + 1 + 1 + MQTT_TOPIC_MAX + 1 + MQTT_PAYLOAD_MAX;
+    static const size_t PAYLOAD_SIZE = 16 + BLOCK_SIZE * 2;
+    static const int RAW_PER_C = 128;
+    static const unsigned long FLUSH_MS = 30000;
+    static constexpr const char *TOPIC = "/heating/recorder";
+    static constexpr const char *CONTROL_TOPIC = "/heating/recorder/in";
+
+private:
+
+    bool enabled = false;
+    uint8_t blocks[2][BLOCK_SIZE]{};
+    size_t sizes[2]{};
+    byte active = 0;
+    bool sealed = false;
+    unsigned long blockStartedAt = 0;
+    unsigned long lastEntryAt = 0;
+    uint32_t seq = 0;
+    unsigned long dropped = 0;
+    uint16_t lastOutputs = 0xFFFF;
+    int16_t lastSensors[SENSOR_ROLES_COUNT]{};
+
+    char payload[PAYLOAD_SIZE]{};
+
+public:
+
+    void start() {
+        enabled = true;
+        sizes[0] = sizes[1] = 0;
+        sealed = false;
+        lastOutputs = 0xFFFF;
+        for (int16_t &raw : lastSensors) raw = INT16_MIN;
+    }
+
+    void stop() {
+        enabled = false;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    /**
+     * Records a raw reading when it differs from the role's last recorded one.
+     */
+    void sensor(byte role, float tempC) {
+        if (!enabled || role >= SENSOR_ROLES_COUNT) return;
+        int16_t raw = static_cast<int16_t>(round(tempC * RAW_PER_C));
+        if (raw == lastSensors[role]) return;
+        uint8_t data[3] = {role, static_cast<uint8_t>(raw), static_cast<uint8_t>(raw >> 8)};
+        if (append(INPUT_SENSOR, data, sizeof(data), nullptr, 0)) lastSensors[role] = raw;
+    }
+
+    void mqtt(const char *topic, const char *message) {
+        if (!enabled || strcmp(topic, CONTROL_TOPIC) == 0) return;
+        size_t topicLength = strlen(topic);
+        size_t messageLength = strlen(message);
+        if (topicLength > MQTT_TOPIC_MAX || messageLength > MQTT_PAYLOAD_MAX) {
+            dropped++;
+            return;
+        }
+
+        uint8_t head[MQTT_TOPIC_MAX + 2];
+        head[0] = static_cast<uint8_t>(topicLength);
+        memcpy(head + 1, topic, topicLength);
+        head[1 + topicLength] = static_cast<uint8_t>(messageLength);
+        append(INPUT_MQTT, head, topicLength + 2, reinterpret_cast<const uint8_t *>(message), messageLength);
+    }
+
+    /**
+     * Records the relay mask when it differs from the last recorded one.
+     */
+    void outputs(uint16_t mask) {
+        if (!enabled || mask == lastOutputs) return;
+        uint8_t data[2] = {static_cast<uint8_t>(mask), static_cast<uint8_t>(mask >> 8)};
+        if (append(INPUT_OUTPUTS, data, sizeof(data), nullptr, 0)) lastOutputs = mask;
+    }
+
+    void state(byte zone, const ControllerState &controllerState) {
+        if (!enabled) return;
+        append(INPUT_STATE, &zone, 1, reinterpret_cast<const uint8_t *>(&controllerState), sizeof(ControllerState));
+    }
+
+    /**
+     * @return block to publish, nullptr while the current one is neither full nor FLUSH_MS old
+     */
+    const char *takeBlock() {
+        if (!sealed) {
+            if (sizes[active] == 0 || millis() - blockStartedAt < FLUSH_MS) return nullptr;
+            seal();
+        }
+
+        static const char HEX_DIGITS[] = "0123456789ABCDEF";
+        const uint8_t *block = blocks[active ^ 1];
+        size_t size = sizes[active ^ 1];
+        int length = snprintf(payload, sizeof(payload), "%lu ", static_cast<unsigned long>(seq++));
+        for (size_t i = 0; i < size; ++i) {
+            payload[length++] = HEX_DIGITS[block[i] >> 4];
+            payload[length++] = HEX_DIGITS[block[i] & 0x0F];
+        }
+        payload[length] = '\0';
+        sealed = false;
+        return payload;
+    }
+
+    unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+
+    bool append(InputEntryType type, const uint8_t *head, size_t headLength, const uint8_t *tail, size_t tailLength) {
+        unsigned long now = millis();
+        uint8_t delta[5];
+        size_t deltaLength = 0;
+        unsigned long ms = now - lastEntryAt;
+        do {
+            delta[deltaLength++] = static_cast<uint8_t>((ms & 0x7F) | (ms > 0x7F ? 0x80 : 0));
+            ms >>= 7;
+        } while (ms > 0);
+
+        size_t length = deltaLength + 1 + headLength + tailLength;
+        if (sizes[active] > 0 && sizes[active] + length > BLOCK_SIZE) {
+            if (sealed) {
+                dropped++;
+                return false;
+            }
+            seal();
+        }
+        if (sizes[active] == 0) {
+            // a new block restarts the deltas from its start time
+            blockStartedAt = lastEntryAt = now;
+            uint32_t start = now;
+            memcpy(blocks[active], &start, sizeof(start));
+            sizes[active] = sizeof(start);
+            delta[0] = 0;
+            deltaLength = 1;
+            length = deltaLength + 1 + headLength + tailLength;
+        }
+        if (sizes[active] + length > BLOCK_SIZE) {
+            dropped++;
+            return false;
+        }
+
+        uint8_t *block = blocks[active];
+        size_t &size = sizes[active];
+        memcpy(block + size, delta, deltaLength);
+        size += deltaLength;
+        block[size++] = type;
+        memcpy(block + size, head, headLength);
+        size += headLength;
+        if (tailLength > 0) memcpy(block + size, tail, tailLength);
+        size += tailLength;
+        lastEntryAt = now;
+        return true;
+    }
+
+    void seal() {
+        active ^= 1;
+        sizes[active] = 0;
+        sealed = true;
+    }
+};
+
+/**
+ * Walks the entries of one decoded block.
+ */
+class InputBlockReader {
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t position = 4;
+    uint32_t time = 0;
+
+public:
+
+    struct Entry {
+        uint32_t time;
+        InputEntryType type;
+        const uint8_t *data;
+        size_t length;
+    };
+
+    InputBlockReader(const uint8_t *data, size_t size) : data(data), size(size) {
+        if (size >= 4) memcpy(&time, data, sizeof(time));
+    }
+
+    /**
+     * @return false at the end of the block or on a truncated entry
+     */
+    bool next(Entry &entry) {
+        unsigned long delta = 0;
+        byte shift = 0;
+        while (position < size) {
+            uint8_t b = data[position++];
+            delta |= static_cast<unsigned long>(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80)) break;
+        }
+        if (position >= size) return false;
+
+        time += delta;
+        entry.time = time;
+        entry.type = static_cast<InputEntryType>(data[position++]);
+        entry.data = data + position;
+
+        size_t length;
+        switch (entry.type) {
+            case INPUT_SENSOR:
+                length = 3;
+                break;
+            case INPUT_OUTPUTS:
+                length = 2;
+                break;
+            case INPUT_STATE:
+                length = 1 + sizeof(ControllerState);
+                break;
+            case INPUT_MQTT:
+                if (position >= size) return false;
+                length = 1 + data[position];
+                if (position + length >= size) return false;
+                length += 1 + data[position + length];
+                break;
+            default:
+                return false;
+        }
+        if (position + length > size) return false;
+        entry.length = length;
+        position += length;
+        return true;
+    }
+};
+
+InputRecorder inputRecorder;
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SMARTHATA_HEATING_LATENCYHISTOGRAM_H
+#define SMARTHATA_HEATING_LATENCYHISTOGRAM_H
+
+#include <Arduino.h>
+
+/**
+ * Fixed-bucket latency histogram in microseconds. Bucket 0 counts samples below 16 us,
+ * bucket i counts samples below 16 << i, the last bucket counts everything longer.
+ * Percentiles are reported as the upper bound of the bucket they fall in, capped at the maximum.
+ */
+class LatencyHistogram {
+public:
+
+    static const byte BUCKETS = 16;
+    static const unsigned long FIRST_BOUND_US = 16;
+
+    void add(unsigned long us) {
+        byte bucket = 0;
+        unsigned long bound = FIRST_BOUND_US;
+        while (bucket < BUCKETS - 1 && us >= bound) {
+            bucket++;
+            bound <<= 1;
+        }
+        counts[bucket]++;
+        count++;
+        if (us > maxUs) maxUs = us;
+    }
+
+    unsigned long percentile(byte percent) const {
+        if (count == 0) return 0;
+        unsigned long rank = count / 100 * percent + (count % 100 * percent + 99) / 100;
+        unsigned long seen = 0;
+        for (byte i = 0; i < BUCKETS - 1; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return bound(i) < maxUs ? bound(i) : maxUs;
+        }
+        return maxUs;
+    }
+
+    static unsigned long bound(byte bucket) {
+        return FIRST_BOUND_US << bucket;
+    }
+
+    unsigned long getCount() const {
+        return count;
+    }
+
+    unsigned long getMaxUs() const {
+        return maxUs;
+    }
+
+    unsigned long getBucket(byte bucket) const {
+        return counts[bucket];
+    }
+
+    /**
+     * Writes one "stage count max p50 p90 p99 bucket,bucket,..." line, times in us.
+     * @return length written, or at least size when the line did not fit
+     */
+    int toLine(const char *stage, char *out, size_t size) const {
+        int length = snprintf(out, size, "%s %lu %lu %lu %lu %lu ",
+                              stage, count, maxUs, percentile(50), percentile(90), percentile(99));
+        for (byte i = 0; i < BUCKETS && length > 0 && static_cast<size_t>(length) < size; ++i) {
+            length += snprintf(out + length, size - length, i == 0 ? "%lu" : ",%lu", counts[i]);
+        }
+        if (length > 0 && static_cast<size_t>(length) < size) {
+            length += snprintf(out + length, size - length, "\n");
+        }
+        return length;
+    }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        count = 0;
+        maxUs = 0;
+    }
+
+private:
+
+    unsigned long counts[BUCKETS]{};
+    unsigned long count = 0;
+    unsigned long maxUs = 0;
+};
+
+#endif
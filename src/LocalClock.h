@@ -0,0 +1,116 @@
+#ifndef SMARTHATA_HEATING_LOCALCLOCK_H
+#define SMARTHATA_HEATING_LOCALCLOCK_H
+
+#include <Arduino.h>
+#include <Interval.h>
+
+#ifdef ESP8266
+#include <time.h>
+#endif
+
+/**
+ * Local wall clock extrapolated from millis(). It is synced from /second-of-day, which gives
+ * the time of day only, and from SNTP where available, which also gives the day of week.
+ * Until SNTP has synced once, the day of week counts from Monday at the first sync.
+ */
+class LocalClock {
+public:
+
+    static const long SECONDS_PER_DAY = 86400L;
+    static const long SECONDS_PER_WEEK = 7 * SECONDS_PER_DAY;
+    static const unsigned int MINUTES_PER_WEEK = 7 * 24 * 60;
+
+private:
+
+    // 1970-01-01 was a Thursday, Monday is day 0
+    static const long EPOCH_DAY_OF_WEEK = 3;
+
+    long syncedSecondOfWeek = -1;
+    unsigned long syncedAt = 0;
+    bool dayKnown = false;
+
+    Interval sntpInterval = Interval(60000);
+    bool sntpStarted = false;
+
+public:
+
+    void begin(const char *ntpServer, long timeZoneOffsetSec) {
+#ifdef ESP8266
+        configTime(timeZoneOffsetSec, 0, ntpServer);
+        sntpStarted = true;
+        sntpInterval.startWithCurrentTimeEnabled();
+#else
+        (void) ntpServer;
+        (void) timeZoneOffsetSec;
+#endif
+    }
+
+    void loop() {
+#ifdef ESP8266
+        if (sntpStarted && sntpInterval.isReady()) {
+            time_t now = time(nullptr);
+            // anything before 2020 means SNTP has not answered yet
+            if (now > 1577836800L) {
+                struct tm local{};
+                localtime_r(&now, &local);
+                long dayOfWeek = (local.tm_wday + 6) % 7;
+                syncSecondOfWeek(dayOfWeek * SECONDS_PER_DAY + local.tm_hour * 3600L + local.tm_min * 60L + local.tm_sec);
+                dayKnown = true;
+            }
+        }
+#endif
+    }
+
+    /**
+     * Keeps the current day of week and picks yesterday, today or tomorrow, whichever is closest
+     * to the extrapolated time, so a sync just around midnight does not jump a whole day.
+     */
+    void syncSecondOfDay(long secondOfDay) {
+        if (secondOfDay < 0 || secondOfDay >= SECONDS_PER_DAY) return;
+        if (!isValid()) {
+            syncSecondOfWeek(secondOfDay);
+            return;
+        }
+        long now = secondOfWeek();
+        long day = now / SECONDS_PER_DAY;
+        long best = day * SECONDS_PER_DAY + secondOfDay;
+        for (long candidateDay = day - 1; candidateDay <= day + 1; candidateDay += 2) {
+            long candidate = candidateDay * SECONDS_PER_DAY + secondOfDay;
+            if (labs(candidate - now) < labs(best - now)) best = candidate;
+        }
+        syncSecondOfWeek((best + SECONDS_PER_WEEK) % SECONDS_PER_WEEK);
+    }
+
+    void syncSecondOfWeek(long secondOfWeek) {
+        syncedSecondOfWeek = secondOfWeek;
+        syncedAt = millis();
+    }
+
+    bool isValid() const {
+        return syncedSecondOfWeek >= 0;
+    }
+
+    bool isDayKnown() const {
+        return dayKnown;
+    }
+
+    /**
+     * @return -1 until the first sync
+     */
+    long secondOfWeek() const {
+        if (!isValid()) return -1;
+        return (syncedSecondOfWeek + static_cast<long>(((millis() - syncedAt) / 1000) % SECONDS_PER_WEEK)) % SECONDS_PER_WEEK;
+    }
+
+    long secondOfDay() const {
+        return isValid() ? secondOfWeek() % SECONDS_PER_DAY : -1;
+    }
+
+    int minuteOfWeek() const {
+        return isValid() ? static_cast<int>(secondOfWeek() / 60) : -1;
+    }
+};
+
+LocalClock localClock;
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef SMARTHATA_HEATING_LOG_H
+#define SMARTHATA_HEATING_LOG_H
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// calls above the build level compile to nothing, -D LOG_LEVEL=LOG_LEVEL_DEBUG for full traces
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// per module build levels, e.g. -D LOG_LEVEL_MQTT=LOG_LEVEL_DEBUG
+#ifndef LOG_LEVEL_HEATING
+#define LOG_LEVEL_HEATING LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_MQTT
+#define LOG_LEVEL_MQTT LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_SENSORS
+#define LOG_LEVEL_SENSORS LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_MIXER
+#define LOG_LEVEL_MIXER LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_BATTERY
+#define LOG_LEVEL_BATTERY LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_STORAGE
+#define LOG_LEVEL_STORAGE LOG_LEVEL
+#endif
+#ifndef LOG_LEVEL_UPLOAD
+#define LOG_LEVEL_UPLOAD LOG_LEVEL
+#endif
+
+enum LogModule : byte {
+    LOG_HEATING, LOG_MQTT, LOG_SENSORS, LOG_MIXER, LOG_BATTERY, LOG_STORAGE, LOG_UPLOAD, LOG_MODULES_COUNT
+};
+
+enum LogSink : byte {
+    LOG_TO_SERIAL, LOG_TO_MQTT
+};
+
+#define LOG_AT(level, module, ...) \
+    do { if ((level) <= LOG_LEVEL_##module) logger.write(LOG_##module, (level), __VA_ARGS__); } while (0)
+
+#define LOG_ERROR(module, ...) LOG_AT(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_WARN(module, ...) LOG_AT(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define LOG_INFO(module, ...) LOG_AT(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG_AT(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+
+// for a line built in several steps, false at build time drops the steps too
+#define LOG_ENABLED(level, module) ((level) <= LOG_LEVEL_##module && logger.isEnabled(LOG_##module, (level)))
+
+/**
+ * Log lines go into a RAM ring as "<millis> <level> <module>: <text>" and a background task
+ * drains them to the serial port as far as its FIFO takes, or in batches to TOPIC, so a log
+ * call never waits for the UART or the broker. A line that does not fit in the ring is
+ * dropped and counted. Levels can be lowered per module at run time, never raised above
+ * the build level.
+ */
+class Logger {
+public:
+
+    static const size_t RING_SIZE = 2048;
+    static const size_t LINE_SIZE = 384;
+    static const unsigned long BATCH_MS = 1000;
+    static constexpr const char *TOPIC = "/heating/log";
+    static constexpr const char *CONTROL_TOPIC = "/heating/log/in";
+
+    static constexpr const char *MODULE_NAMES[LOG_MODULES_COUNT] = {
+            "heating", "mqtt", "sensors", "mixer", "battery", "storage", "upload"
+    };
+    static constexpr const char *LEVEL_NAMES[] = {"none", "error", "warn", "info", "debug"};
+
+private:
+
+    static constexpr byte BUILD_LEVELS[LOG_MODULES_COUNT] = {
+            LOG_LEVEL_HEATING, LOG_LEVEL_MQTT, LOG_LEVEL_SENSORS, LOG_LEVEL_MIXER,
+            LOG_LEVEL_BATTERY, LOG_LEVEL_STORAGE, LOG_LEVEL_UPLOAD
+    };
+
+    char ring[RING_SIZE]{};
+    size_t start = 0;
+    size_t used = 0;
+    unsigned long dropped = 0;
+    byte levels[LOG_MODULES_COUNT]{};
+    LogSink sink = LOG_TO_SERIAL;
+    unsigned long takenAt = 0;
+
+public:
+
+    Logger() {
+        memcpy(levels, BUILD_LEVELS, sizeof(levels));
+    }
+
+    bool isEnabled(LogModule module, byte level) const {
+        return level <= levels[module];
+    }
+
+    __attribute__((format(printf, 4, 5)))
+    void write(LogModule module, byte level, const char *format, ...) {
+        if (!isEnabled(module, level)) return;
+
+        static const char LEVEL_LETTERS[] = "-EWID";
+        char line[LINE_SIZE];
+        int length = snprintf(line, sizeof(line), "%lu %c %s: ", millis(), LEVEL_LETTERS[level], MODULE_NAMES[module]);
+        va_list args;
+        va_start(args, format);
+        int text = vsnprintf(line + length, sizeof(line) - length, format, args);
+        va_end(args);
+
+        size_t size = min(static_cast<size_t>(length + max(text, 0)), sizeof(line) - 2);
+        line[size++] = '\n';
+        if (size > RING_SIZE - used) {
+            dropped++;
+            return;
+        }
+        size_t end = (start + used) % RING_SIZE;
+        size_t first = min(size, RING_SIZE - end);
+        memcpy(ring + end, line, first);
+        memcpy(ring, line + first, size - first);
+        used += size;
+    }
+
+    /**
+     * Writes what the serial FIFO takes without blocking.
+     */
+    void drain(HardwareSerial &serial) {
+        int room = serial.availableForWrite();
+        while (room > 0 && used > 0) {
+            size_t chunk = min(min(used, RING_SIZE - start), static_cast<size_t>(room));
+            serial.write(reinterpret_cast<const uint8_t *>(ring + start), chunk);
+            consume(chunk);
+            room -= static_cast<int>(chunk);
+        }
+    }
+
+    /**
+     * Takes whole lines for one MQTT publish, once half of out is filled or BATCH_MS passed.
+     * @param size at least LINE_SIZE
+     * @return false while there is nothing to publish yet
+     */
+    bool takeBatch(char *out, size_t size) {
+        if (used == 0 || (used < size / 2 && millis() - takenAt < BATCH_MS)) return false;
+
+        size_t length = 0;
+        size_t lineLength = 0;
+        while (length + lineLength < used && length + lineLength < size - 1) {
+            char c = ring[(start + length + lineLength++) % RING_SIZE];
+            if (c == '\n') {
+                length += lineLength;
+                lineLength = 0;
+            }
+        }
+        for (size_t i = 0; i < length; ++i) out[i] = ring[(start + i) % RING_SIZE];
+        out[length] = '\0';
+        consume(length);
+        takenAt = millis();
+        return length > 0;
+    }
+
+    /**
+     * "sink serial", "sink mqtt", or "<module> <level>" with module "all" for every module,
+     * e.g. "mqtt debug" or "all warn".
+     * @return false on an unknown command
+     */
+    bool configure(const char *command) {
+        const char *separator = strchr(command, ' ');
+        if (separator == nullptr) return false;
+        const char *value = separator + 1;
+        size_t nameLength = static_cast<size_t>(separator - command);
+
+        if (nameLength == 4 && strncmp(command, "sink", 4) == 0) {
+            if (strcmp(value, "serial") == 0) {
+                sink = LOG_TO_SERIAL;
+            } else if (strcmp(value, "mqtt") == 0) {
+                sink = LOG_TO_MQTT;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        int level = -1;
+        for (byte i = 0; i < sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]); ++i) {
+            if (strcmp(value, LEVEL_NAMES[i]) == 0) level = i;
+        }
+        if (level < 0) return false;
+
+        bool all = nameLength == 3 && strncmp(command, "all", 3) == 0;
+        bool found = false;
+        for (byte i = 0; i < LOG_MODULES_COUNT; ++i) {
+            if (all || (strlen(MODULE_NAMES[i]) == nameLength && strncmp(command, MODULE_NAMES[i], nameLength) == 0)) {
+                levels[i] = min(static_cast<byte>(level), BUILD_LEVELS[i]);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    LogSink getSink() const {
+        return sink;
+    }
+
+    unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+
+    void consume(size_t size) {
+        start = (start + size) % RING_SIZE;
+        used -= size;
+    }
+};
+
+constexpr const char *Logger::MODULE_NAMES[];
+constexpr const char *Logger::LEVEL_NAMES[];
+constexpr byte Logger::BUILD_LEVELS[];
+
+Logger logger;
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SMARTHATA_HEATING_MEMORYSTATS_H
+#define SMARTHATA_HEATING_MEMORYSTATS_H
+
+#include <Arduino.h>
+
+/**
+ * Free heap, largest free block, fragmentation and the free stack of the loop, sampled from
+ * a background task. Keeps the worst values since boot and over the current report window,
+ * a slow leak shows as a falling minimum from window to window.
+ */
+class MemoryStats {
+private:
+    uint32_t heapFree = 0;
+    uint32_t maxBlock = 0;
+    uint8_t fragmentation = 0;
+    uint32_t stackFree = 0;
+
+    uint32_t heapFreeMin = UINT32_MAX;
+    uint32_t maxBlockMin = UINT32_MAX;
+    uint8_t fragmentationMax = 0;
+
+    uint32_t windowHeapFreeMin = UINT32_MAX;
+    uint32_t windowMaxBlockMin = UINT32_MAX;
+    uint8_t windowFragmentationMax = 0;
+
+public:
+
+    void sample() {
+        heapFree = ESP.getFreeHeap();
+        maxBlock = ESP.getMaxFreeBlockSize();
+        fragmentation = ESP.getHeapFragmentation();
+        // the core paints the stack at boot, this is its high-water mark
+        stackFree = ESP.getFreeContStack();
+
+        heapFreeMin = min(heapFreeMin, heapFree);
+        maxBlockMin = min(maxBlockMin, maxBlock);
+        fragmentationMax = max(fragmentationMax, fragmentation);
+        windowHeapFreeMin = min(windowHeapFreeMin, heapFree);
+        windowMaxBlockMin = min(windowMaxBlockMin, maxBlock);
+        windowFragmentationMax = max(windowFragmentationMax, fragmentation);
+    }
+
+    uint32_t getHeapFree() const {
+        return heapFree;
+    }
+
+    uint32_t getHeapFreeMin() const {
+        return heapFreeMin;
+    }
+
+    uint32_t getMaxBlock() const {
+        return maxBlock;
+    }
+
+    uint32_t getMaxBlockMin() const {
+        return maxBlockMin;
+    }
+
+    uint8_t getFragmentation() const {
+        return fragmentation;
+    }
+
+    uint8_t getFragmentationMax() const {
+        return fragmentationMax;
+    }
+
+    uint32_t getStackFree() const {
+        return stackFree;
+    }
+
+    /**
+     * Writes the window as JSON and starts the next one.
+     */
+    void takeReport(char *out, size_t size) {
+        if (windowHeapFreeMin == UINT32_MAX) sample();
+        snprintf(out, size, "{\"heap-free\":%lu,\"heap-free-min\":%lu,\"heap-free-min-boot\":%lu,"
+                            "\"max-block-min\":%lu,\"frag-max\":%u,\"frag-max-boot\":%u,\"stack-free-min\":%lu}",
+                 static_cast<unsigned long>(heapFree), static_cast<unsigned long>(windowHeapFreeMin),
+                 static_cast<unsigned long>(heapFreeMin), static_cast<unsigned long>(windowMaxBlockMin),
+                 windowFragmentationMax, fragmentationMax, static_cast<unsigned long>(stackFree));
+
+        windowHeapFreeMin = UINT32_MAX;
+        windowMaxBlockMin = UINT32_MAX;
+        windowFragmentationMax = 0;
+    }
+};
+
+#endif
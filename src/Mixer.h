@@ -1,126 +1,511 @@
 #ifndef SMARTHATA_HEATING_MIXER_H
 #define SMARTHATA_HEATING_MIXER_H
 
-#include <PIDController.h>
 #include <DeviceWiFi.h>
 #include <Timeout.h>
 #include <Interval.h>
-#include "MixerRelays.h"
+#include "MixerValve.h"
+#include "HeatingCurve.h"
+#include "WeeklySchedule.h"
+#include "Pid.h"
+#include "RelayAutotune.h"
 #include "TemperatureSensors.h"
+#include "ControllerSnapshot.h"
+#include "TelemetryLog.h"
+#include "Zones.h"
+#include "Log.h"
 
 
-class MediumValue {
+/**
+ * Cascade controller of one floor zone. The fast inner loop moves the valve to hold the mixed water
+ * at mixedSetpoint. The slow outer loop sets mixedSetpoint from the corrected floor
+ * temperature, the measured floor delta, a PI trim on the floor medium temperature
+ * and a room temperature term.
+ */
+class Mixer : public Arduinable {
+
 private:
-    float value = 0;
-    int count = 0;
-public:
-    void add(double newValue) {
-        value += newValue;
-        count++;
-    }
 
-    double medium() {
-        if (count == 0) return 0;
-        return value / count;
-    }
+    static constexpr float MIXED_SETPOINT_MIN = 20.0f;
+    static constexpr float MIXED_SETPOINT_MAX = 45.0f;
+    static constexpr float OUTER_TRIM_LIMIT = 10.0f;
+    static const long MIN_PULSE_MS = 500;
+    static const long RESTORE_UNCERTAINTY_MS = 5000;
+    // the snapshot keeps the last valid value of the first six roles, the street one among them
+    static const byte SNAPSHOT_ROLES = sizeof(ControllerState::temps) / sizeof(ControllerState::temps[0]);
+    static_assert(ROLE_STREET < SNAPSHOT_ROLES && SNAPSHOT_ROLES <= SENSOR_ROLES_COUNT,
+                  "new roles go after the six the snapshot keeps");
 
-    void reset() {
-        value = 0;
-        count = 0;
-    }
+    static constexpr float CALIBRATION_HOT_DELTA = 2.0f;
+    static constexpr float CALIBRATION_RISE_DELTA = 0.5f;
 
-    double mediumAndReset() {
-        double d = medium();
-        reset();
-        return d;
-    }
-};
+    static constexpr float AUTOTUNE_AMPLITUDE_SEC = 4.0f;
+    static constexpr float AUTOTUNE_HYSTERESIS = 0.3f;
+    static const unsigned long AUTOTUNE_TIMEOUT_MS = 3 * 3600000UL;
 
-class Mixer : public Arduinable {
+    static const uint32_t TUNING_MAGIC = 0x4D545531;
 
-private:
+    struct StoredTuning {
+        uint32_t magic;
+        float innerKp;
+        float innerKi;
+        float innerKd;
+        float outerKp;
+        float outerKi;
+        float deadband;
+        float roomGain;
+        uint8_t crc;
+    };
 
-    static const uint MIXER_MAX_POSITION_MS = 140000;
+    enum Calibration {
+        CALIBRATION_NONE, CALIBRATION_HOMING, CALIBRATION_OPENING
+    };
 
-    //                        12   1   2   3   4   5  6  7  8  9 10 11
-    int8_t corrections[24] = {-3, -3, -2, -2, -2, -1, 0, 0, 0, 0, 0, 0,
-                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    const FloorZoneConfig &zone;
+    char tuningPath[16]{};
+
+    Pid innerPid;
+    Interval innerInterval = Interval(30000);
+    unsigned long lastInnerTime = 0;
+    float innerDeadband = 0.3f;
+
+    Pid outerPid;
+    Interval outerInterval = Interval(10UL * 60000);
+    unsigned long lastOuterTime = 0;
+    float roomGain = 1.0f;
 
-    PIDController pid;
-    Interval pidInterval = Interval(20UL * 60000);
     Interval mediumValueInterval = Interval(30000);
-    MediumValue mediumValue;
+    MeanFilter mediumValue;
+    MeanFilter deltaValue;
+
+    MixerValve valve = MixerValve(zone.upPin, zone.downPin);
+    HeatingCurve curve;
+    SmartHeatingDto lastValid;
 
-    MixerRelays mixerRelays;
+    Calibration calibration = CALIBRATION_NONE;
+    unsigned long calibrationStarted = 0;
+    unsigned long calibrationLag = 0;
+    float calibrationStartTemp = 0;
 
-    int mixerPosition = 0;
+    RelayAutotune autotune;
 
 public:
 
     float floorTemp = 30.0f;
     float floorTempCorrected = floorTemp;
+    float roomTemp = DEVICE_DISCONNECTED_C;
+    float roomTempExpected = DEVICE_DISCONNECTED_C;
+    float mixedSetpoint = floorTempCorrected;
     double valueSec = 0;
 
-    Mixer() {
+    Mixer(const FloorZoneConfig &zone, byte index) : zone(zone) {
         pinMode(LED_BUILTIN, OUTPUT);
 
-        mixerRelays.down(MIXER_MAX_POSITION_MS);
+        curve.begin(index);
+        zoneFilePath(tuningPath, sizeof(tuningPath), "tuning", index);
 
-        pid.begin();
-        pid.tune(25, 0, 0);
-        pid.limit(-20, 20);
-        pid.setpoint(floorTempCorrected);
+        innerPid.tune(2, 0.005f, 0);
+        innerPid.limit(-10, 10);
+        outerPid.tune(1, 1.0f / 3600, 0);
+        outerPid.limit(-OUTER_TRIM_LIMIT, OUTER_TRIM_LIMIT);
+        if (loadTuning()) {
+            LOG_INFO(MIXER, "tuning loaded");
+        }
 
         mediumValueInterval.startWithCurrentTimeEnabled();
-        pidInterval.startWithCurrentTime();
+        innerInterval.startWithCurrentTime();
+        outerInterval.startWithCurrentTime();
+        lastInnerTime = lastOuterTime = millis();
+
+    }
+
+    /**
+     * Resumes from a warm-restart snapshot, or homes the valve when there is none.
+     * The restored position gets RESTORE_UNCERTAINTY_MS on top for moves after the snapshot.
+     */
+    void begin(const ControllerState *state) {
+        if (state == nullptr) {
+            valve.home();
+            return;
+        }
+        valve.setTravelMs(state->valveTravelMs);
+        valve.setPosition(state->valvePositionMs, state->valveUncertaintyMs + RESTORE_UNCERTAINTY_MS);
+        innerPid.setIntegral(state->innerIntegral);
+        outerPid.setIntegral(state->outerIntegral);
+        floorTemp = state->floorTemp / 100.0f;
+        mixedSetpoint = state->mixedSetpoint / 100.0f;
+
+        for (byte i = 0; i < SNAPSHOT_ROLES; ++i) {
+            lastValid.temps[i] = state->temps[i] / 100.0f;
+        }
+    }
+
+    void snapshot(ControllerState &state) const {
+        state.valvePositionMs = valve.getPositionMs();
+        state.valveUncertaintyMs = valve.getUncertaintyMs();
+        state.valveTravelMs = valve.getTravelMs();
+        state.innerIntegral = innerPid.getIntegral();
+        state.outerIntegral = outerPid.getIntegral();
+        state.floorTemp = TelemetryRecord::toCenti(floorTemp);
+        state.mixedSetpoint = TelemetryRecord::toCenti(mixedSetpoint);
+
+        for (byte i = 0; i < SNAPSHOT_ROLES; ++i) {
+            state.temps[i] = TelemetryRecord::toCenti(lastValid.temps[i]);
+        }
+    }
 
+    /**
+     * @return true when the valve is idle and its position differs from the snapshot by more than 1% of travel
+     */
+    bool hasMovedSince(const ControllerState &state) const {
+        long moved = valve.getPositionMs() - state.valvePositionMs;
+        if (moved < 0) moved = -moved;
+        return !valve.isMoving() && moved > valve.getTravelMs() / 100;
     }
 
     void loop() override {
-        mixerRelays.loop();
+        valve.loop();
     }
 
+    bool isValveMoving() const {
+        return valve.isMoving();
+    }
+
+    void stopValve() {
+        valve.stop();
+    }
+
+    /**
+     * Stale sensors read as disconnected: the valve holds while the mixed temperature is stale,
+     * and the floor delta is left out while the cold one is.
+     */
     void checkMixer(const SmartHeatingDto &th) {
-        if (TemperatureSensors::isValidTemp(th.floorMixedTemp)) {
+        if (calibration != CALIBRATION_NONE) {
+            checkCalibration(th);
+            return;
+        }
+        if (autotune.isRunning()) {
+            checkAutotune(th);
+            return;
+        }
+        rememberValid(th);
+        float mixedTemp = th.temp(zone.mixedRole);
+        float coldTemp = th.temp(zone.coldRole);
+        if (TemperatureSensors::isValidTemp(mixedTemp)) {
             floorTempCorrected = calcFloorTempExpected(th);
             if (mediumValueInterval.isReady()) {
-                mediumValue.add(calcFloorMediumTemp(th));
+                mediumValue.add(calcFloorMediumTemp(mixedTemp, coldTemp));
+                if (TemperatureSensors::isValidTemp(coldTemp)) {
+                    deltaValue.add(mixedTemp - coldTemp);
+                }
+            }
+            if (outerInterval.isReady()) {
+                computeOuter();
             }
-            if (pidInterval.isReady()) {
-                pid.setpoint(floorTempCorrected);
+            if (innerInterval.isReady()) {
+                computeInner(mixedTemp);
+            }
+        }
+    }
 
-                valueSec = pid.compute(mediumValue.mediumAndReset());
-                int time = round(valueSec * 1000);
-                mixerRelays.run(time);
+    /**
+     * Applies "key=value" pairs separated by spaces, commas or semicolons:
+     * inner-kp, inner-ki, inner-kd, inner-sec, deadband, outer-kp, outer-ki, outer-sec, room-gain.
+     * Gains, deadband and room gain are saved and restored at boot.
+     * @return number of applied keys
+     */
+    byte configure(const char *payload) {
+        byte applied = 0;
+        const char *p = payload;
+        while (*p) {
+            while (*p == ' ' || *p == ',' || *p == ';') p++;
+            const char *equals = strchr(p, '=');
+            if (equals == nullptr) break;
+            char *end;
+            float value = strtof(equals + 1, &end);
+            if (end != equals + 1 && configure(p, static_cast<size_t>(equals - p), value)) applied++;
+            p = end != equals + 1 ? end : equals + 1;
+        }
+        if (applied > 0) saveTuning();
+        return applied;
+    }
 
-                mixerPosition = constrain((uint) (mixerPosition + time), 0, MIXER_MAX_POSITION_MS);
-            }
+    /**
+     * Measures the full-stroke travel time: homes the valve closed, then opens it
+     * until the mixed water reaches the hot supply temperature. The delay before
+     * the mixed temperature starts to rise is taken as sensor lag and subtracted.
+     */
+    void startCalibration() {
+        autotune.abort("calibration started");
+        calibration = CALIBRATION_HOMING;
+        valve.home();
+    }
+
+    bool isCalibrating() const {
+        return calibration != CALIBRATION_NONE;
+    }
+
+    /**
+     * Tunes the inner loop with a relay-feedback experiment around the current mixed setpoint:
+     * the valve gets +-AUTOTUNE_AMPLITUDE_SEC pulses every inner interval until the mixed
+     * temperature oscillates steadily. The ultimate gain and period give Ziegler-Nichols PI
+     * gains, which are applied and saved. The outer loop is frozen meanwhile.
+     * @return false while calibrating or already tuning
+     */
+    bool startAutotune() {
+        if (calibration != CALIBRATION_NONE || autotune.isRunning()) return false;
+        autotune.start(mixedSetpoint, AUTOTUNE_AMPLITUDE_SEC, AUTOTUNE_HYSTERESIS, AUTOTUNE_TIMEOUT_MS);
+        return true;
+    }
+
+    /**
+     * Reports a finished auto-tune once.
+     * @return false while it is running or nothing was started
+     */
+    bool takeAutotuneReport(char *out, size_t size) {
+        RelayAutotune::State state = autotune.getState();
+        if (state == RelayAutotune::AUTOTUNE_DONE) {
+            snprintf(out, size, "Mixer autotune done, ku=%.3f pu=%.0fs inner-kp=%.3f inner-ki=%.5f",
+                     autotune.getUltimateGain(), autotune.getUltimatePeriodSec(), innerPid.getKp(), innerPid.getKi());
+        } else if (state == RelayAutotune::AUTOTUNE_FAILED) {
+            snprintf(out, size, "Mixer autotune failed, %s", autotune.getError());
+        } else {
+            return false;
         }
+        autotune.reset();
+        return true;
+    }
+
+    unsigned int getMixerPositionPercentage() const {
+        return valve.getPositionPercentage();
+    }
+
+    long getTravelMs() const {
+        return valve.getTravelMs();
+    }
+
+    bool isHoming() const {
+        return valve.isHoming();
     }
 
-    unsigned int getMixerPositionPercentage() {
-        return 100 * mixerPosition / MIXER_MAX_POSITION_MS;
+    /**
+     * @return MixerRelays::getState() of the valve
+     */
+    byte getRelayState() const {
+        return valve.getRelayState();
+    }
+
+    bool configureCurve(const char *payload) {
+        return curve.configure(payload);
+    }
+
+    void printCurve(char *out, size_t size) const {
+        curve.print(out, size);
+    }
+
+    unsigned long takeCutoffLateMaxMs() {
+        return valve.takeCutoffLateMaxMs();
+    }
+
+    const char *getName() const {
+        return zone.name;
     }
 
 private:
 
-    float calcFloorMediumTemp(const SmartHeatingDto &th) const {
-        float floorMediumTemp = th.floorMixedTemp;
-        if (TemperatureSensors::isValidTemp(th.floorColdTemp))
-            floorMediumTemp = (th.floorMixedTemp + th.floorColdTemp) * 0.5f;
+    void checkCalibration(const SmartHeatingDto &th) {
+        float mixedTemp = th.temp(zone.mixedRole);
+        float hotTemp = th.temp(ROLE_HOT);
+        if (calibration == CALIBRATION_HOMING) {
+            if (!valve.isMoving()) {
+                calibration = CALIBRATION_OPENING;
+                calibrationStarted = millis();
+                calibrationLag = 0;
+                calibrationStartTemp = mixedTemp;
+                valve.up(static_cast<unsigned long>(valve.getTravelMs() * 2));
+            }
+            return;
+        }
+
+        bool valid = TemperatureSensors::isValidTemp(mixedTemp) &&
+                     TemperatureSensors::isValidTemp(hotTemp);
+        if (valid && calibrationLag == 0 && mixedTemp >= calibrationStartTemp + CALIBRATION_RISE_DELTA) {
+            calibrationLag = millis() - calibrationStarted;
+        }
+        if (valid && mixedTemp >= hotTemp - CALIBRATION_HOT_DELTA) {
+            long travel = static_cast<long>(millis() - calibrationStarted - calibrationLag);
+            valve.stop();
+            valve.setTravelMs(travel);
+            valve.setPosition(travel, 0);
+            LOG_INFO(MIXER, "travel calibrated, ms = %ld", travel);
+            finishCalibration();
+        } else if (!valve.isMoving()) {
+            LOG_WARN(MIXER, "calibration failed, hot temperature not reached");
+            valve.home();
+            finishCalibration();
+        }
+    }
+
+    void checkAutotune(const SmartHeatingDto &th) {
+        float mixedTemp = th.temp(zone.mixedRole);
+        if (!TemperatureSensors::isValidTemp(mixedTemp)) {
+            autotune.abort("mixed temperature lost");
+        } else if (mixedTemp > MIXED_SETPOINT_MAX + 5) {
+            autotune.abort("mixed temperature too high");
+        } else if (innerInterval.isReady()) {
+            float output = autotune.step(mixedTemp);
+            if (valve.saturation() != 0 && valve.saturation() == (output > 0 ? 1 : -1)) {
+                autotune.abort("valve reached its end");
+            } else if (output != 0) {
+                valve.move(lround(output * 1000));
+            }
+        }
+
+        if (autotune.getState() == RelayAutotune::AUTOTUNE_DONE) {
+            // Ziegler-Nichols PI
+            float kp = 0.45f * autotune.getUltimateGain();
+            float ki = kp * 1.2f / autotune.getUltimatePeriodSec();
+            innerPid.tune(kp, ki, 0);
+            saveTuning();
+            LOG_INFO(MIXER, "autotuned, kp = %.2f, ki = %.5f", kp, ki);
+        }
+        if (!autotune.isRunning()) finishCalibration();
+    }
+
+    void finishCalibration() {
+        calibration = CALIBRATION_NONE;
+        innerPid.reset();
+        outerPid.reset();
+        mediumValue.reset();
+        deltaValue.reset();
+        innerInterval.startWithCurrentTime();
+        outerInterval.startWithCurrentTime();
+        lastInnerTime = lastOuterTime = millis();
+    }
+
+    void computeOuter() {
+        float dtSec = (millis() - lastOuterTime) / 1000.0f;
+        lastOuterTime = millis();
+        if (mediumValue.isEmpty()) return;
+
+        outerPid.setpoint(floorTempCorrected);
+        int saturation = mixedSetpoint >= MIXED_SETPOINT_MAX ? 1 : mixedSetpoint <= MIXED_SETPOINT_MIN ? -1 : 0;
+        float trim = outerPid.compute(mediumValue.takeMean(), dtSec, saturation);
+
+        float halfDelta = !deltaValue.isEmpty() ? deltaValue.takeMean() * 0.5f : 0;
+        float roomTrim = 0;
+        if (TemperatureSensors::isValidTemp(roomTemp) && TemperatureSensors::isValidTemp(roomTempExpected)) {
+            roomTrim = roomGain * (roomTempExpected - roomTemp);
+        }
+        float setpoint = floorTempCorrected + halfDelta + trim + roomTrim;
+        mixedSetpoint = constrain(setpoint, MIXED_SETPOINT_MIN, MIXED_SETPOINT_MAX);
+    }
+
+    void computeInner(float mixedTemp) {
+        float dtSec = (millis() - lastInnerTime) / 1000.0f;
+        lastInnerTime = millis();
+
+        innerPid.setpoint(mixedSetpoint);
+        float error = mixedSetpoint - mixedTemp;
+        if (error < innerDeadband && error > -innerDeadband) {
+            valueSec = 0;
+            return;
+        }
+        valueSec = innerPid.compute(mixedTemp, dtSec, valve.saturation());
+        long time = lround(valueSec * 1000);
+        if (time >= MIN_PULSE_MS || time <= -MIN_PULSE_MS) {
+            valve.move(time);
+        }
+    }
+
+    bool configure(const char *key, size_t length, float value) {
+        if (isnan(value) || isinf(value)) return false;
+        if (keyEquals(key, length, "inner-kp") && value >= 0) innerPid.tune(value, innerPid.getKi(), innerPid.getKd());
+        else if (keyEquals(key, length, "inner-ki") && value >= 0) innerPid.tune(innerPid.getKp(), value, innerPid.getKd());
+        else if (keyEquals(key, length, "inner-kd") && value >= 0) innerPid.tune(innerPid.getKp(), innerPid.getKi(), value);
+        else if (keyEquals(key, length, "inner-sec") && value >= 3) innerInterval.setInterval(lround(value * 1000));
+        else if (keyEquals(key, length, "deadband") && value >= 0) innerDeadband = value;
+        else if (keyEquals(key, length, "outer-kp") && value >= 0) outerPid.tune(value, outerPid.getKi(), outerPid.getKd());
+        else if (keyEquals(key, length, "outer-ki") && value >= 0) outerPid.tune(outerPid.getKp(), value, outerPid.getKd());
+        else if (keyEquals(key, length, "outer-sec") && value >= 30) outerInterval.setInterval(lround(value * 1000));
+        else if (keyEquals(key, length, "room-gain") && value >= 0) roomGain = value;
+        else return false;
+        return true;
+    }
+
+    static bool isTuningValue(float value) {
+        return !isnan(value) && !isinf(value) && value >= 0;
+    }
+
+    bool loadTuning() {
+        File file = SPIFFS.open(tuningPath, "r");
+        if (!file) return false;
+        StoredTuning stored{};
+        bool valid = file.read(reinterpret_cast<uint8_t *>(&stored), sizeof(StoredTuning)) == sizeof(StoredTuning)
+                     && stored.magic == TUNING_MAGIC
+                     && stored.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(StoredTuning, crc))
+                     && isTuningValue(stored.innerKp) && isTuningValue(stored.innerKi) && isTuningValue(stored.innerKd)
+                     && isTuningValue(stored.outerKp) && isTuningValue(stored.outerKi) && isTuningValue(stored.roomGain)
+                     && isTuningValue(stored.deadband);
+        file.close();
+        if (valid) {
+            innerPid.tune(stored.innerKp, stored.innerKi, stored.innerKd);
+            outerPid.tune(stored.outerKp, stored.outerKi, outerPid.getKd());
+            innerDeadband = stored.deadband;
+            roomGain = stored.roomGain;
+        }
+        return valid;
+    }
+
+    void saveTuning() {
+        StoredTuning stored{};
+        stored.magic = TUNING_MAGIC;
+        stored.innerKp = innerPid.getKp();
+        stored.innerKi = innerPid.getKi();
+        stored.innerKd = innerPid.getKd();
+        stored.outerKp = outerPid.getKp();
+        stored.outerKi = outerPid.getKi();
+        stored.deadband = innerDeadband;
+        stored.roomGain = roomGain;
+        stored.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(StoredTuning, crc));
+        File file = SPIFFS.open(tuningPath, "w");
+        if (!file) return;
+        file.write(reinterpret_cast<const uint8_t *>(&stored), sizeof(StoredTuning));
+        file.close();
+    }
+
+    static bool keyEquals(const char *key, size_t length, const char *expected) {
+        return strlen(expected) == length && strncmp(key, expected, length) == 0;
+    }
+
+    static float calcFloorMediumTemp(float mixedTemp, float coldTemp) {
+        float floorMediumTemp = mixedTemp;
+        if (TemperatureSensors::isValidTemp(coldTemp))
+            floorMediumTemp = (mixedTemp + coldTemp) * 0.5f;
         return floorMediumTemp;
     }
 
+    void rememberValid(const SmartHeatingDto &th) {
+        for (byte i = 0; i < SENSOR_ROLES_COUNT; ++i) {
+            keepValid(lastValid.temps[i], th.temps[i]);
+        }
+    }
+
+    static void keepValid(float &valid, float value) {
+        if (TemperatureSensors::isValidTemp(value)) valid = value;
+    }
+
+    /**
+     * Falls back to the last valid street temperature, which survives restarts in the snapshot.
+     */
     float calcFloorTempExpected(const SmartHeatingDto &th) const {
         float expected = floorTemp;
-        if (TemperatureSensors::isValidTemp(th.streetTemp)) {
-            expected = expected - th.streetTemp * 0.3f;
-        }
-        if (mqttUpdate.secondOfDay >= 0) {
-            byte hourOfDay = static_cast<byte>(mqttUpdate.secondOfDay / 3600);
-            expected = expected + corrections[hourOfDay];
+        if (TemperatureSensors::isValidTemp(th.temp(ROLE_STREET))) {
+            expected = expected + curve.offset(th.temp(ROLE_STREET));
+        } else if (TemperatureSensors::isValidTemp(lastValid.temp(ROLE_STREET))) {
+            expected = expected + curve.offset(lastValid.temp(ROLE_STREET));
         }
-        return expected;
+        return expected + weeklySchedule.value(zone.schedule);
     }
 
 
@@ -7,27 +7,35 @@
 class MixerRelays {
 public:
 
-    void run(int time) {
+    MixerRelays(uint8_t upPin, uint8_t downPin) : relayMixerUp(upPin), relayMixerDown(downPin) {}
+
+    void run(long time) {
         if (time > 0) {
-            up(static_cast<unsigned int>(time));
+            up(static_cast<unsigned long>(time));
         } else {
-            down(static_cast<unsigned int>(-time));
+            down(static_cast<unsigned long>(-time));
         }
     }
 
-    void up(unsigned int timeEnabled) {
+    void up(unsigned long timeEnabled) {
+        finishRun();
         relayMixerDown.disable();
         relayMixerUp.enable();
-        relayTimeout.start(timeEnabled);
+        startRun(1, timeEnabled);
     }
 
-    void down(unsigned int timeEnabled) {
+    void down(unsigned long timeEnabled) {
+        finishRun();
         relayMixerUp.disable();
         relayMixerDown.enable();
-        relayTimeout.start(timeEnabled);
+        startRun(-1, timeEnabled);
     }
 
     void loop() {
+        if (direction != 0 && relayTimeout.isReady()) {
+            unsigned long late = millis() - runStarted - runTime;
+            if (late > cutoffLateMaxMs) cutoffLateMaxMs = late;
+        }
         if (relayTimeout.isReady()) {
             if (relayMixerUp.isEnabled()) {
                 relayMixerUp.disable();
@@ -35,20 +43,70 @@ public:
             if (relayMixerDown.isEnabled()) {
                 relayMixerDown.disable();
             }
+            finishRun();
         }
     }
 
     void disable() {
         relayMixerUp.disable();
         relayMixerDown.disable();
+        finishRun();
+    }
+
+    bool isRunning() const {
+        return direction != 0;
+    }
+
+    /**
+     * @return bit 0 set while the up relay is energized, bit 1 for the down relay
+     */
+    byte getState() const {
+        return (relayMixerUp.isEnabled() ? 1 : 0) | (relayMixerDown.isEnabled() ? 2 : 0);
+    }
+
+    /**
+     * @return signed time the relays were actually energized since the previous call, up is positive
+     */
+    long takeRunTime() {
+        long time = finishedRunTime;
+        finishedRunTime = 0;
+        return time;
+    }
+
+    /**
+     * @return worst delay between a commanded run end and the relay cut-off since the previous call
+     */
+    unsigned long takeCutoffLateMaxMs() {
+        unsigned long late = cutoffLateMaxMs;
+        cutoffLateMaxMs = 0;
+        return late;
     }
 
 private:
 
-    Relay relayMixerUp = Relay(RELAY_MIXER_UP_PIN);
-    Relay relayMixerDown = Relay(RELAY_MIXER_DOWN_PIN);
+    Relay relayMixerUp;
+    Relay relayMixerDown;
 
     Timeout relayTimeout = Timeout();
+
+    int8_t direction = 0;
+    unsigned long runStarted = 0;
+    unsigned long runTime = 0;
+    long finishedRunTime = 0;
+    unsigned long cutoffLateMaxMs = 0;
+
+    void startRun(int8_t runDirection, unsigned long timeEnabled) {
+        direction = runDirection;
+        runStarted = millis();
+        runTime = timeEnabled;
+        relayTimeout.start(timeEnabled);
+    }
+
+    void finishRun() {
+        if (direction == 0) return;
+        finishedRunTime += direction * static_cast<long>(millis() - runStarted);
+        direction = 0;
+    }
 };
 
 #endif
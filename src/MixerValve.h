@@ -0,0 +1,167 @@
+#ifndef SMARTHATA_HEATING_MIXERVALVE_H
+#define SMARTHATA_HEATING_MIXERVALVE_H
+
+#include "MixerRelays.h"
+
+/**
+ * Dead-reckoning model of the mixing valve actuator, fed with the real relay on-time.
+ * Backlash is subtracted after a direction change, and the position uncertainty grows
+ * with every move until the valve is driven into an end stop again.
+ */
+class MixerValve {
+public:
+    static const long DEFAULT_TRAVEL_MS = 140000;
+    static const long BACKLASH_MS = 1500;
+    static const byte DRIFT_PERCENT = 2;
+    static const byte REHOME_UNCERTAINTY_PERCENT = 10;
+    static const byte HOMING_MARGIN_PERCENT = 10;
+
+private:
+    MixerRelays relays;
+
+    long travelMs = DEFAULT_TRAVEL_MS;
+    long positionMs = 0;
+    long uncertaintyMs = DEFAULT_TRAVEL_MS;
+    int8_t lastDirection = 0;
+    bool homing = false;
+
+    unsigned long homings = 0;
+
+public:
+
+    MixerValve(uint8_t upPin, uint8_t downPin) : relays(upPin, downPin) {}
+
+    void loop() {
+        relays.loop();
+        account(relays.takeRunTime());
+    }
+
+    void home() {
+        homing = true;
+        uncertaintyMs = travelMs;
+        relays.down(travelMs + travelMs * HOMING_MARGIN_PERCENT / 100);
+    }
+
+    /**
+     * Moves the valve by time, positive is up. The command is limited to the remaining travel,
+     * unless the position is uncertain and the target is near an end stop: then the valve is
+     * overdriven into the stop to re-home. Commands are ignored until re-homing completes.
+     * @return time actually commanded
+     */
+    long move(long time) {
+        if (homing) return 0;
+
+        long target = positionMs + time;
+        bool rehome = uncertaintyMs > travelMs * REHOME_UNCERTAINTY_PERCENT / 100;
+
+        if (target <= uncertaintyMs && rehome && time < 0) {
+            time = -(positionMs + uncertaintyMs + BACKLASH_MS);
+            homing = true;
+        } else if (target >= travelMs - uncertaintyMs && rehome && time > 0) {
+            time = travelMs - positionMs + uncertaintyMs + BACKLASH_MS;
+            homing = true;
+        } else {
+            time = constrain(target, 0L, travelMs) - positionMs;
+        }
+
+        if (time != 0 && lastDirection != 0 && (time > 0) != (lastDirection > 0)) {
+            time += time > 0 ? BACKLASH_MS : -BACKLASH_MS;
+        }
+        if (time != 0) {
+            relays.run(time);
+        }
+        return time;
+    }
+
+    void stop() {
+        relays.disable();
+        account(relays.takeRunTime());
+        homing = false;
+    }
+
+    void up(unsigned long time) {
+        relays.up(time);
+    }
+
+    bool isMoving() const {
+        return relays.isRunning();
+    }
+
+    bool isHoming() const {
+        return homing;
+    }
+
+    byte getRelayState() const {
+        return relays.getState();
+    }
+
+    unsigned long takeCutoffLateMaxMs() {
+        return relays.takeCutoffLateMaxMs();
+    }
+
+    /**
+     * @return +1 at the upper end stop, -1 at the lower one, 0 in between
+     */
+    int saturation() const {
+        if (positionMs <= 0) return -1;
+        if (positionMs >= travelMs) return 1;
+        return 0;
+    }
+
+    long getTravelMs() const {
+        return travelMs;
+    }
+
+    void setTravelMs(long travel) {
+        travelMs = travel;
+        positionMs = constrain(positionMs, 0L, travelMs);
+    }
+
+    long getPositionMs() const {
+        return positionMs;
+    }
+
+    void setPosition(long position, long uncertainty) {
+        positionMs = constrain(position, 0L, travelMs);
+        uncertaintyMs = uncertainty;
+    }
+
+    long getUncertaintyMs() const {
+        return uncertaintyMs;
+    }
+
+    unsigned int getPositionPercentage() const {
+        return static_cast<unsigned int>(100 * positionMs / travelMs);
+    }
+
+    unsigned long getHomings() const {
+        return homings;
+    }
+
+private:
+
+    void account(long runTime) {
+        if (runTime == 0) return;
+        if (!relays.isRunning()) homing = false;
+
+        int8_t direction = runTime > 0 ? 1 : -1;
+        long moved = runTime > 0 ? runTime : -runTime;
+        if (lastDirection != 0 && direction != lastDirection) {
+            moved = moved > BACKLASH_MS ? moved - BACKLASH_MS : 0;
+        }
+        lastDirection = direction;
+
+        long target = positionMs + direction * moved;
+        long worstCase = direction < 0 ? positionMs + uncertaintyMs : travelMs - positionMs + uncertaintyMs;
+        if (moved >= (worstCase < travelMs ? worstCase : travelMs)) {
+            uncertaintyMs = 0;
+            homings++;
+        } else {
+            uncertaintyMs += moved * DRIFT_PERCENT / 100;
+            if (uncertaintyMs > travelMs) uncertaintyMs = travelMs;
+        }
+        positionMs = constrain(target, 0L, travelMs);
+    }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef SMARTHATA_HEATING_MQTTROUTER_H
+#define SMARTHATA_HEATING_MQTTROUTER_H
+
+#include <Arduino.h>
+
+/**
+ * @param zone index registered with the route, lets one handler serve the same topic of several zones
+ */
+typedef void (*MqttHandler)(const char *payload, unsigned int length, byte zone);
+
+constexpr uint32_t mqttTopicHash(const char *topic, uint32_t hash = 2166136261UL) {
+    return *topic ? mqttTopicHash(topic + 1, (hash ^ static_cast<uint8_t>(*topic)) * 16777619UL) : hash;
+}
+
+struct MqttRoute {
+    const char *topic;
+    uint32_t hash;
+    MqttHandler handler;
+    int qos;
+    byte zone;
+};
+
+/**
+ * Fixed table of inbound topics. Topics are hashed once on registration,
+ * an incoming message costs one hash and a strcmp on the matching route.
+ */
+template<byte N>
+class MqttRouter {
+public:
+    static const byte ROUTES_MAX = N;
+
+private:
+    MqttRoute routes[ROUTES_MAX]{};
+    byte count = 0;
+
+public:
+
+    bool on(const char *topic, MqttHandler handler, int qos = 0, byte zone = 0) {
+        if (count == ROUTES_MAX) return false;
+        routes[count++] = {topic, mqttTopicHash(topic), handler, qos, zone};
+        return true;
+    }
+
+    bool dispatch(const char *topic, const char *payload, unsigned int length) const {
+        const uint32_t hash = mqttTopicHash(topic);
+        for (byte i = 0; i < count; ++i) {
+            if (routes[i].hash == hash && strcmp(routes[i].topic, topic) == 0) {
+                routes[i].handler(payload, length, routes[i].zone);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    byte size() const {
+        return count;
+    }
+
+    const MqttRoute &route(byte i) const {
+        return routes[i];
+    }
+};
+
+/**
+ * Heap-free payload parsing helpers for NUL-terminated MQTT payloads.
+ */
+namespace MqttPayload {
+
+    inline bool equals(const char *payload, const char *value) {
+        return strcmp(payload, value) == 0;
+    }
+
+    inline float toFloat(const char *payload) {
+        return static_cast<float>(strtod(payload, nullptr));
+    }
+
+    inline long toInt(const char *payload) {
+        return strtol(payload, nullptr, 10);
+    }
+
+    /**
+     * @return false when the payload and its terminator do not fit in out, out is then empty
+     */
+    inline bool copy(char *out, size_t size, const char *payload, unsigned int length) {
+        if (length >= size) {
+            out[0] = '\0';
+            return false;
+        }
+        memcpy(out, payload, length);
+        out[length] = '\0';
+        return true;
+    }
+
+    /**
+     * Finds "key": in a flat JSON object and parses the number after it.
+     */
+    inline bool jsonNumber(const char *payload, const char *key, float &value) {
+        const size_t keyLength = strlen(key);
+        for (const char *p = strchr(payload, '"'); p != nullptr; p = strchr(p + 1, '"')) {
+            if (strncmp(p + 1, key, keyLength) != 0 || p[keyLength + 1] != '"') continue;
+            const char *c = p + keyLength + 2;
+            while (*c == ' ') c++;
+            if (*c != ':') continue;
+            char *end;
+            double number = strtod(c + 1, &end);
+            if (end == c + 1) return false;
+            value = static_cast<float>(number);
+            return true;
+        }
+        return false;
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SMARTHATA_HEATING_PID_H
+#define SMARTHATA_HEATING_PID_H
+
+/**
+ * PID with output limits and conditional integration: the integral is frozen
+ * while the output or the actuator is saturated in the direction of the error.
+ */
+class Pid {
+private:
+    float kp = 0;
+    float ki = 0;
+    float kd = 0;
+    float outMin = -1e9f;
+    float outMax = 1e9f;
+    float target = 0;
+
+    float integral = 0;
+    float lastError = 0;
+    bool hasLastError = false;
+
+public:
+
+    void tune(float p, float i, float d) {
+        kp = p;
+        ki = i;
+        kd = d;
+    }
+
+    void limit(float minOutput, float maxOutput) {
+        outMin = minOutput;
+        outMax = maxOutput;
+    }
+
+    void setpoint(float value) {
+        target = value;
+    }
+
+    float getSetpoint() const {
+        return target;
+    }
+
+    float getKp() const { return kp; }
+
+    float getKi() const { return ki; }
+
+    float getKd() const { return kd; }
+
+    float getIntegral() const {
+        return integral;
+    }
+
+    void setIntegral(float value) {
+        integral = constrain(value, outMin, outMax);
+    }
+
+    void reset() {
+        integral = 0;
+        hasLastError = false;
+    }
+
+    /**
+     * @param dtSec time since the previous compute
+     * @param saturation +1 if the actuator is at its upper end, -1 at its lower end, 0 otherwise
+     */
+    float compute(float input, float dtSec, int saturation = 0) {
+        const float error = target - input;
+        const float proportional = kp * error;
+        const float derivative = hasLastError && dtSec > 0 ? kd * (error - lastError) / dtSec : 0;
+        lastError = error;
+        hasLastError = true;
+
+        const float nextIntegral = integral + ki * error * dtSec;
+        const float output = proportional + nextIntegral + derivative;
+        const bool windsUp = (error > 0 && (output > outMax || saturation > 0)) ||
+                             (error < 0 && (output < outMin || saturation < 0));
+        if (!windsUp) {
+            integral = constrain(nextIntegral, outMin, outMax);
+        }
+
+        const float result = proportional + integral + derivative;
+        return constrain(result, outMin, outMax);
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef SMARTHATA_HEATING_RELAYAUTOTUNE_H
+#define SMARTHATA_HEATING_RELAYAUTOTUNE_H
+
+#include <Arduino.h>
+
+/**
+ * Relay-feedback experiment (Astrom-Hagglund). The output switches between +amplitude and
+ * -amplitude whenever the input leaves setpoint +- hysteresis, which makes the loop oscillate
+ * at its ultimate period. After the first settling cycle the peaks and periods of CYCLES
+ * cycles are averaged into the ultimate gain Ku = 4d / (pi * sqrt(a^2 - h^2)) and period Pu.
+ */
+class RelayAutotune {
+public:
+
+    enum State {
+        AUTOTUNE_IDLE, AUTOTUNE_RUNNING, AUTOTUNE_DONE, AUTOTUNE_FAILED
+    };
+
+    static const byte CYCLES = 3;
+
+private:
+
+    State state = AUTOTUNE_IDLE;
+    const char *error = "";
+
+    float target = 0;
+    float amplitude = 0;
+    float hysteresis = 0;
+    unsigned long startedAt = 0;
+    unsigned long timeoutMs = 0;
+
+    bool high = true;
+    float peakMax = 0;
+    float peakMin = 0;
+    unsigned long cycleStartedAt = 0;
+    byte switches = 0;
+
+    byte cycles = 0;
+    float swingSum = 0;
+    unsigned long periodSumMs = 0;
+
+    float ultimateGain = 0;
+    float ultimatePeriodSec = 0;
+
+public:
+
+    void start(float setpoint, float outputAmplitude, float inputHysteresis, unsigned long maxDurationMs) {
+        state = AUTOTUNE_RUNNING;
+        error = "";
+        target = setpoint;
+        amplitude = outputAmplitude;
+        hysteresis = inputHysteresis;
+        startedAt = millis();
+        timeoutMs = maxDurationMs;
+        high = true;
+        peakMax = peakMin = setpoint;
+        switches = 0;
+        cycles = 0;
+        swingSum = 0;
+        periodSumMs = 0;
+    }
+
+    /**
+     * @return relay output for the input, 0 when not running
+     */
+    float step(float input) {
+        if (state != AUTOTUNE_RUNNING) return 0;
+        unsigned long now = millis();
+        if (now - startedAt >= timeoutMs) {
+            fail("no stable oscillation");
+            return 0;
+        }
+
+        if (input > peakMax) peakMax = input;
+        if (input < peakMin) peakMin = input;
+
+        if (high && input > target + hysteresis) {
+            high = false;
+            // a full cycle ends on every high to low switch
+            if (switches >= 2) measureCycle(now);
+            cycleStartedAt = now;
+            peakMax = peakMin = input;
+            switches++;
+        } else if (!high && input < target - hysteresis) {
+            high = true;
+            switches++;
+        }
+
+        if (state != AUTOTUNE_RUNNING) return 0;
+        return high ? amplitude : -amplitude;
+    }
+
+    void abort(const char *reason) {
+        if (state == AUTOTUNE_RUNNING) fail(reason);
+    }
+
+    void reset() {
+        state = AUTOTUNE_IDLE;
+    }
+
+    State getState() const {
+        return state;
+    }
+
+    bool isRunning() const {
+        return state == AUTOTUNE_RUNNING;
+    }
+
+    const char *getError() const {
+        return error;
+    }
+
+    float getUltimateGain() const {
+        return ultimateGain;
+    }
+
+    float getUltimatePeriodSec() const {
+        return ultimatePeriodSec;
+    }
+
+private:
+
+    void measureCycle(unsigned long now) {
+        // the first cycle only settles the oscillation
+        if (switches >= 4) {
+            swingSum += peakMax - peakMin;
+            periodSumMs += now - cycleStartedAt;
+            cycles++;
+        }
+        if (cycles < CYCLES) return;
+
+        float a = swingSum / cycles / 2;
+        if (a <= hysteresis) {
+            fail("oscillation below hysteresis");
+            return;
+        }
+        ultimateGain = 4 * amplitude / (static_cast<float>(M_PI) * sqrtf(a * a - hysteresis * hysteresis));
+        ultimatePeriodSec = periodSumMs / 1000.0f / cycles;
+        state = AUTOTUNE_DONE;
+    }
+
+    void fail(const char *reason) {
+        error = reason;
+        state = AUTOTUNE_FAILED;
+    }
+};
+
+#endif
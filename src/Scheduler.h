@@ -0,0 +1,162 @@
+#ifndef SMARTHATA_HEATING_SCHEDULER_H
+#define SMARTHATA_HEATING_SCHEDULER_H
+
+#include <Arduino.h>
+#include "LatencyHistogram.h"
+#include "Log.h"
+
+typedef void (*TaskFunction)(void *context);
+
+enum TaskPriority : byte {
+    PRIORITY_CRITICAL, PRIORITY_CONTROL, PRIORITY_NORMAL, PRIORITY_BACKGROUND
+};
+
+struct SchedulerTask {
+    const char *name;
+    TaskPriority priority;
+    unsigned long periodMs;
+    unsigned long deadlineMs;
+    unsigned long budgetUs;
+    TaskFunction function;
+    void *context;
+
+    unsigned long dueAt;
+
+    unsigned long runs;
+    unsigned long lateMaxMs;
+    unsigned long lateSumMs;
+    unsigned long missed;
+    unsigned long overruns;
+    unsigned long durationMaxUs;
+    unsigned long durationSumUs;
+};
+
+/**
+ * Cooperative scheduler. Due tasks run in priority order, critical tasks are serviced again
+ * after every other task, and a pass stops early once it has used FRAME_BUDGET_US so the
+ * remaining tasks are picked up on the next pass. A task with zero period runs on every pass.
+ * Lateness against the due time is recorded per task as jitter, run times as max and mean per
+ * task, a histogram is kept only for the whole pass.
+ */
+class Scheduler {
+public:
+
+    static const byte MAX_TASKS = 24;
+    static const unsigned long FRAME_BUDGET_US = 20000;
+
+    /**
+     * @return task index, or -1 when the table is full
+     */
+    int add(const char *name, TaskPriority priority, unsigned long periodMs, unsigned long deadlineMs,
+            unsigned long budgetUs, TaskFunction function, void *context) {
+        if (count >= MAX_TASKS) {
+            LOG_ERROR(HEATING, "scheduler full, task %s never runs", name);
+            return -1;
+        }
+
+        byte index = count++;
+        while (index > 0 && tasks[index - 1].priority > priority) {
+            tasks[index] = tasks[index - 1];
+            index--;
+        }
+        tasks[index] = SchedulerTask{name, priority, periodMs, deadlineMs, budgetUs, function, context,
+                                     millis() + periodMs, 0, 0, 0, 0, 0, 0, 0};
+        return index;
+    }
+
+    void loop() {
+        unsigned long passStarted = micros();
+        for (byte i = 0; i < count; ++i) {
+            SchedulerTask &task = tasks[i];
+            if (task.priority == PRIORITY_CRITICAL) {
+                run(task);
+                continue;
+            }
+            if (!isDue(task)) continue;
+            if (micros() - passStarted >= FRAME_BUDGET_US) break;
+
+            run(task);
+            runCritical();
+        }
+        passes.add(micros() - passStarted);
+    }
+
+    byte size() const {
+        return count;
+    }
+
+    const LatencyHistogram &getPasses() const {
+        return passes;
+    }
+
+    /**
+     * Writes one "name runs late-max late-mean missed overruns duration-max-us duration-mean-us"
+     * line per task from task from on, as many whole lines as fit.
+     * @return index of the first task left out, size() when all fit
+     */
+    byte report(char *out, size_t size, byte from = 0) const {
+        size_t length = 0;
+        out[0] = '\0';
+        for (byte i = from; i < count; ++i) {
+            const SchedulerTask &t = tasks[i];
+            int written = snprintf(out + length, size - length, "%s %lu %lu %lu %lu %lu %lu %lu\n",
+                                   t.name, t.runs, t.lateMaxMs, t.runs ? t.lateSumMs / t.runs : 0,
+                                   t.missed, t.overruns, t.durationMaxUs, t.runs ? t.durationSumUs / t.runs : 0);
+            if (written < 0 || length + written >= size) {
+                out[length] = '\0';
+                return i;
+            }
+            length += written;
+        }
+        return count;
+    }
+
+    void resetStats() {
+        for (byte i = 0; i < count; ++i) {
+            SchedulerTask &t = tasks[i];
+            t.runs = t.lateMaxMs = t.lateSumMs = t.missed = t.overruns = 0;
+            t.durationMaxUs = t.durationSumUs = 0;
+        }
+        passes.reset();
+    }
+
+private:
+
+    SchedulerTask tasks[MAX_TASKS]{};
+    byte count = 0;
+    LatencyHistogram passes;
+
+    static bool isDue(const SchedulerTask &task) {
+        return static_cast<long>(millis() - task.dueAt) >= 0;
+    }
+
+    void runCritical() {
+        for (byte i = 0; i < count && tasks[i].priority == PRIORITY_CRITICAL; ++i) {
+            run(tasks[i]);
+        }
+    }
+
+    static void run(SchedulerTask &task) {
+        unsigned long now = millis();
+        unsigned long late = task.periodMs > 0 ? now - task.dueAt : 0;
+
+        unsigned long started = micros();
+        task.function(task.context);
+        unsigned long duration = micros() - started;
+
+        task.runs++;
+        task.lateSumMs += late;
+        if (late > task.lateMaxMs) task.lateMaxMs = late;
+        if (late > task.deadlineMs) task.missed++;
+        task.durationSumUs += duration;
+        if (duration > task.durationMaxUs) task.durationMaxUs = duration;
+        if (duration > task.budgetUs) task.overruns++;
+
+        task.dueAt += task.periodMs;
+        if (static_cast<long>(now - task.dueAt) >= 0) {
+            task.dueAt = now + task.periodMs;
+        }
+    }
+};
+
+#endif
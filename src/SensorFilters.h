@@ -0,0 +1,208 @@
+#ifndef SMARTHATA_HEATING_SENSORFILTERS_H
+#define SMARTHATA_HEATING_SENSORFILTERS_H
+
+#include <Arduino.h>
+
+/**
+ * Arithmetic mean of the samples added since the last take.
+ */
+class MeanFilter {
+private:
+    double sum = 0;
+    unsigned int count = 0;
+
+public:
+    void add(float value) {
+        sum += value;
+        count++;
+    }
+
+    bool isEmpty() const {
+        return count == 0;
+    }
+
+    float mean() const {
+        return count > 0 ? static_cast<float>(sum / count) : 0;
+    }
+
+    float takeMean() {
+        float value = mean();
+        reset();
+        return value;
+    }
+
+    void reset() {
+        sum = 0;
+        count = 0;
+    }
+};
+
+/**
+ * Exponential moving average, alpha 1 passes samples through.
+ */
+class EmaFilter {
+private:
+    float alpha;
+    float value = 0;
+    bool primed = false;
+
+public:
+    explicit EmaFilter(float alpha = 1) : alpha(alpha) {}
+
+    float add(float sample) {
+        value = primed ? value + alpha * (sample - value) : sample;
+        primed = true;
+        return value;
+    }
+
+    float get() const {
+        return value;
+    }
+
+    void reset() {
+        primed = false;
+    }
+};
+
+/**
+ * Median of the last N samples, N odd. Until the window is full the median of what is there.
+ */
+template<byte N>
+class MedianFilter {
+private:
+    float window[N]{};
+    byte count = 0;
+    byte next = 0;
+
+public:
+    float add(float sample) {
+        window[next] = sample;
+        next = (next + 1) % N;
+        if (count < N) count++;
+
+        float sorted[N];
+        for (byte i = 0; i < count; ++i) {
+            float value = window[i];
+            byte j = i;
+            while (j > 0 && sorted[j - 1] > value) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = value;
+        }
+        return sorted[count / 2];
+    }
+
+    void reset() {
+        count = 0;
+        next = 0;
+    }
+};
+
+/**
+ * Rejects samples that move away from the last accepted one faster than maxPerSec allows,
+ * plus a fixed step for sensor noise. After MAX_REJECTS rejections in a row the sample is
+ * taken as a real step change.
+ */
+class RateLimiter {
+public:
+    static const byte MAX_REJECTS = 3;
+
+private:
+    float maxPerSec;
+    float noise;
+    float last = 0;
+    unsigned long lastAt = 0;
+    bool primed = false;
+    byte rejects = 0;
+
+public:
+    RateLimiter(float maxPerSec, float noise) : maxPerSec(maxPerSec), noise(noise) {}
+
+    bool accept(float sample, unsigned long now) {
+        if (primed && rejects < MAX_REJECTS) {
+            float allowed = noise + maxPerSec * (now - lastAt) / 1000.0f;
+            float change = sample - last;
+            if (change > allowed || change < -allowed) {
+                rejects++;
+                return false;
+            }
+        }
+        last = sample;
+        lastAt = now;
+        primed = true;
+        rejects = 0;
+        return true;
+    }
+
+    void reset() {
+        primed = false;
+        rejects = 0;
+    }
+};
+
+struct SensorFilterConfig {
+    float maxRatePerSec;
+    float noise;
+    float emaAlpha;
+    unsigned long staleAfterMs;
+};
+
+/**
+ * Filter chain of one sensor: rate-of-change rejection, median of 3, EMA. Keeps the time of the
+ * last accepted sample, the value turns stale when nothing was accepted within staleAfterMs.
+ */
+class SensorFilter {
+private:
+    SensorFilterConfig config;
+    RateLimiter limiter;
+    MedianFilter<3> median;
+    EmaFilter ema;
+
+    unsigned long updatedAt = 0;
+    bool hasValue = false;
+    unsigned long rejected = 0;
+
+public:
+    explicit SensorFilter(const SensorFilterConfig &config) :
+            config(config), limiter(config.maxRatePerSec, config.noise), ema(config.emaAlpha) {}
+
+    /**
+     * @return true when the sample was accepted
+     */
+    bool add(float sample, unsigned long now) {
+        if (!limiter.accept(sample, now)) {
+            rejected++;
+            return false;
+        }
+        ema.add(median.add(sample));
+        updatedAt = now;
+        hasValue = true;
+        return true;
+    }
+
+    float get() const {
+        return ema.get();
+    }
+
+    bool isStale(unsigned long now) const {
+        return !hasValue || now - updatedAt >= config.staleAfterMs;
+    }
+
+    unsigned long getUpdatedAt() const {
+        return updatedAt;
+    }
+
+    unsigned long getRejected() const {
+        return rejected;
+    }
+
+    void reset() {
+        limiter.reset();
+        median.reset();
+        ema.reset();
+        hasValue = false;
+    }
+};
+
+#endif
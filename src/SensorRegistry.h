@@ -0,0 +1,180 @@
+#ifndef SMARTHATA_HEATING_SENSORREGISTRY_H
+#define SMARTHATA_HEATING_SENSORREGISTRY_H
+
+#include <DallasTemperature.h>
+#include <FS.h>
+#include "Log.h"
+
+enum SensorRole : byte {
+    ROLE_MIXED,
+    ROLE_COLD,
+    ROLE_HOT,
+    ROLE_BATTERY,
+    ROLE_BOILER,
+    ROLE_STREET,
+    // roles of further zones go here, see the steps in Zones.h
+    SENSOR_ROLES_COUNT
+};
+
+/**
+ * Maps sensor roles to DS18B20 ROMs. The map is loaded from SPIFFS on boot,
+ * a background bus scan moves a role to a new probe when exactly one role is missing
+ * and exactly one unknown probe is present.
+ */
+class SensorRegistry {
+public:
+    static const byte SCAN_MAX = 16;
+
+    static constexpr const char *ROLE_NAMES[] = {"mixed", "cold", "hot", "battery", "boiler", "street"};
+    static_assert(sizeof(ROLE_NAMES) / sizeof(ROLE_NAMES[0]) == SENSOR_ROLES_COUNT, "every SensorRole needs a name");
+
+private:
+    static constexpr const char *PATH = "/sensors.bin";
+    static const uint32_t MAGIC = 0x53524731;
+
+    struct Stored {
+        uint32_t magic;
+        DeviceAddress addresses[SENSOR_ROLES_COUNT];
+        uint8_t crc;
+    };
+
+    // roles without a built-in address stay unassigned until set over MQTT or found by a scan
+    DeviceAddress addresses[SENSOR_ROLES_COUNT] = {
+            {0x28, 0x61, 0xBF, 0x3A, 0x06, 0x00, 0x00, 0x48},
+            {0x28, 0x55, 0x8A, 0xCC, 0x06, 0x00, 0x00, 0x57},
+            {0x28, 0x6F, 0xE8, 0xCA, 0x06, 0x00, 0x00, 0xEE},
+            {0x28, 0xC2, 0x6E, 0xCB, 0x06, 0x00, 0x00, 0x20},
+            {0x28, 0xD4, 0xD3, 0xE1, 0x06, 0x00, 0x00, 0x01},
+            {0x28, 0xFF, 0x98, 0x3A, 0x91, 0x16, 0x04, 0x36},
+    };
+
+    DeviceAddress found[SCAN_MAX]{};
+    byte foundCount = 0;
+    bool scanning = false;
+
+public:
+
+    void begin() {
+        if (!SPIFFS.begin() || !load()) {
+            LOG_INFO(SENSORS, "SensorRegistry: using built-in sensor addresses");
+            save();
+        }
+    }
+
+    uint8_t *address(SensorRole role) {
+        return addresses[role];
+    }
+
+    bool assign(SensorRole role, const uint8_t *rom) {
+        if (role >= SENSOR_ROLES_COUNT || rom[0] == 0 || OneWire::crc8(rom, 7) != rom[7]) return false;
+        memcpy(addresses[role], rom, sizeof(DeviceAddress));
+        LOG_INFO(SENSORS, "SensorRegistry: %s -> {0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X}",
+                 ROLE_NAMES[role], rom[0], rom[1], rom[2], rom[3], rom[4], rom[5], rom[6], rom[7]);
+        save();
+        return true;
+    }
+
+    static int findRole(const char *name) {
+        for (byte i = 0; i < SENSOR_ROLES_COUNT; ++i) {
+            if (strcmp(ROLE_NAMES[i], name) == 0) return i;
+        }
+        return -1;
+    }
+
+    /**
+     * Finds one device per call.
+     * @return true when a full pass over the bus has been completed
+     */
+    bool scanStep(OneWire &oneWire) {
+        if (!scanning) {
+            oneWire.reset_search();
+            foundCount = 0;
+            scanning = true;
+        }
+
+        DeviceAddress rom;
+        if (oneWire.search(rom)) {
+            if (foundCount < SCAN_MAX && OneWire::crc8(rom, 7) == rom[7]) {
+                memcpy(found[foundCount++], rom, sizeof(DeviceAddress));
+            }
+            return false;
+        }
+
+        scanning = false;
+        reconcile();
+        return true;
+    }
+
+    byte getFoundCount() const {
+        return foundCount;
+    }
+
+private:
+
+    bool isFound(const uint8_t *rom) const {
+        for (byte i = 0; i < foundCount; ++i) {
+            if (memcmp(found[i], rom, sizeof(DeviceAddress)) == 0) return true;
+        }
+        return false;
+    }
+
+    int findAssignedRole(const uint8_t *rom) const {
+        for (byte i = 0; i < SENSOR_ROLES_COUNT; ++i) {
+            if (memcmp(addresses[i], rom, sizeof(DeviceAddress)) == 0) return i;
+        }
+        return -1;
+    }
+
+    void reconcile() {
+        int missingRole = -1;
+        byte missingCount = 0;
+        for (byte i = 0; i < SENSOR_ROLES_COUNT; ++i) {
+            if (!isFound(addresses[i])) {
+                missingRole = i;
+                missingCount++;
+            }
+        }
+
+        int unknown = -1;
+        byte unknownCount = 0;
+        for (byte i = 0; i < foundCount; ++i) {
+            if (findAssignedRole(found[i]) < 0) {
+                unknown = i;
+                unknownCount++;
+            }
+        }
+
+        if (missingCount == 1 && unknownCount == 1) {
+            assign(static_cast<SensorRole>(missingRole), found[unknown]);
+        } else if (missingCount > 0 || unknownCount > 0) {
+            LOG_WARN(SENSORS, "SensorRegistry: missing %u, unknown %u", missingCount, unknownCount);
+        }
+    }
+
+    bool load() {
+        File file = SPIFFS.open(PATH, "r");
+        if (!file) return false;
+        Stored stored{};
+        bool valid = file.read(reinterpret_cast<uint8_t *>(&stored), sizeof(Stored)) == sizeof(Stored)
+                     && stored.magic == MAGIC
+                     && stored.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        file.close();
+        if (valid) memcpy(addresses, stored.addresses, sizeof(addresses));
+        return valid;
+    }
+
+    void save() {
+        Stored stored{};
+        stored.magic = MAGIC;
+        memcpy(stored.addresses, addresses, sizeof(addresses));
+        stored.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        File file = SPIFFS.open(PATH, "w");
+        if (!file) return;
+        file.write(reinterpret_cast<const uint8_t *>(&stored), sizeof(Stored));
+        file.close();
+    }
+};
+
+constexpr const char *SensorRegistry::ROLE_NAMES[];
+
+#endif
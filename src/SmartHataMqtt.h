@@ -2,54 +2,190 @@
 #define SMARTHATA_MQTT_H
 
 #include <ESP8266WiFi.h>
-#include <ESP8266httpUpdate.h>
 #include <WiFiClient.h>
 #include <MQTTClient.h>
 #include <Timeout.h>
+#include "MqttRouter.h"
+#include "SensorRegistry.h"
+#include "LocalClock.h"
+#include "WeeklySchedule.h"
+#include "Zones.h"
+#include "InputRecorder.h"
+#include "Log.h"
 
 
-struct MqttUpdate {
-    int secondOfDay = -1;
+/**
+ * Commands for one floor zone.
+ */
+struct FloorZoneUpdate {
+    bool calibrate = false;
 
-    bool firmwareUpdate = false;
+    bool autotune = false;
+
+    bool tuningUpdate = false;
+    bool tuningTooLong = false;
+    char tuning[128]{};
+
+    bool curveUpdate = false;
+    bool curveTooLong = false;
+    char curve[128]{};
 
     bool floorTempUpdate = false;
     float floorTemp = 0;
 
-    float bedroomTemp = -127.0f;
-    float bedroomHum = -127.0f;
+    bool encodingUpdate = false;
+    bool compact = false;
+};
+
+/**
+ * Last reading of a radiator zone's room.
+ */
+struct RoomUpdate {
+    float temp = -127.0f;
+    float hum = -127.0f;
+    unsigned long updatedAt = 0;
+};
+
+struct MqttUpdate {
+    bool firmwareUpdate = false;
+
+    bool restart = false;
+
+    bool scheduleUpdate = false;
+    bool scheduleTooLong = false;
+    char schedule[WeeklySchedule::BLOB_SIZE]{};
+
+    FloorZoneUpdate floors[FLOOR_ZONES_COUNT];
+    RoomUpdate rooms[RADIATOR_ZONES_COUNT];
+
+    bool sensorUpdate = false;
+    int sensorRole = -1;
+    uint8_t sensorAddress[8]{};
+
+    bool recorderUpdate = false;
+    bool recorderOn = false;
+
+    bool logUpdate = false;
+    char log[32]{};
 } mqttUpdate;
 
 
-void messageReceived(String &topic, String &payload) {
-    Serial.print("incoming: [" + topic + "] - [" + payload + "]\n");
-    if (topic.equals("/heating/floor/in")) {
-        if (payload.equals("update")) {
-            mqttUpdate.firmwareUpdate = true;
-        } else if (payload.equals("restart")) {
-            ESP.restart();
-        } else {
-            mqttUpdate.floorTemp = payload.toFloat();
-            mqttUpdate.floorTempUpdate = true;
-        }
-    } else if (topic.equals("/second-of-day")) {
-        mqttUpdate.secondOfDay = payload.toInt();
-
-    } else if (topic.equals("/room/bedroom")) {
-        DynamicJsonBuffer jsonBuffer;
-        const JsonVariant &root = jsonBuffer.parse(payload);
-        mqttUpdate.bedroomHum = root["hum"];
-        mqttUpdate.bedroomTemp = root["temp"];
+/**
+ * "update" and "restart" apply to the whole controller whichever zone topic they come on.
+ * "compact" and "json" select the encoding of the zone's telemetry topic.
+ */
+void onHeatingFloorIn(const char *payload, unsigned int, byte zone) {
+    FloorZoneUpdate &floor = mqttUpdate.floors[zone];
+    if (MqttPayload::equals(payload, "update")) {
+        mqttUpdate.firmwareUpdate = true;
+    } else if (MqttPayload::equals(payload, "restart")) {
+        mqttUpdate.restart = true;
+    } else if (MqttPayload::equals(payload, "calibrate")) {
+        floor.calibrate = true;
+    } else if (MqttPayload::equals(payload, "autotune")) {
+        floor.autotune = true;
+    } else if (MqttPayload::equals(payload, "compact") || MqttPayload::equals(payload, "json")) {
+        floor.compact = MqttPayload::equals(payload, "compact");
+        floor.encodingUpdate = true;
+    } else {
+        floor.floorTemp = MqttPayload::toFloat(payload);
+        floor.floorTempUpdate = true;
+    }
+}
+
+void onHeatingFloorPid(const char *payload, unsigned int length, byte zone) {
+    FloorZoneUpdate &floor = mqttUpdate.floors[zone];
+    floor.tuningTooLong = !MqttPayload::copy(floor.tuning, sizeof(floor.tuning), payload, length);
+    floor.tuningUpdate = true;
+}
+
+void onHeatingFloorCurve(const char *payload, unsigned int length, byte zone) {
+    FloorZoneUpdate &floor = mqttUpdate.floors[zone];
+    floor.curveTooLong = !MqttPayload::copy(floor.curve, sizeof(floor.curve), payload, length);
+    floor.curveUpdate = true;
+}
+
+void onSecondOfDay(const char *payload, unsigned int, byte) {
+    localClock.syncSecondOfDay(MqttPayload::toInt(payload));
+}
+
+void onHeatingSchedule(const char *payload, unsigned int length, byte) {
+    mqttUpdate.scheduleTooLong = !MqttPayload::copy(mqttUpdate.schedule, sizeof(mqttUpdate.schedule), payload, length);
+    mqttUpdate.scheduleUpdate = true;
+}
+
+void onRoom(const char *payload, unsigned int, byte zone) {
+    RoomUpdate &room = mqttUpdate.rooms[zone];
+    MqttPayload::jsonNumber(payload, "hum", room.hum);
+    if (MqttPayload::jsonNumber(payload, "temp", room.temp)) {
+        room.updatedAt = millis();
+    }
+}
+
+/**
+ * Payload "<role> <16 hex digits ROM>", e.g. "street 28FF983A91160436".
+ */
+void onSensors(const char *payload, unsigned int, byte) {
+    const char *separator = strchr(payload, ' ');
+    if (separator == nullptr || strlen(separator + 1) < 16) return;
+
+    char role[16]{};
+    size_t roleLength = static_cast<size_t>(separator - payload);
+    if (roleLength >= sizeof(role)) return;
+    memcpy(role, payload, roleLength);
+
+    uint8_t address[8];
+    for (byte i = 0; i < 8; ++i) {
+        char hex[3] = {separator[1 + i * 2], separator[2 + i * 2], '\0'};
+        if (!isxdigit(hex[0]) || !isxdigit(hex[1])) return;
+        address[i] = static_cast<uint8_t>(strtoul(hex, nullptr, 16));
     }
+    // family code 0 is no device, an all-zero ROM would pass the CRC
+    if (address[0] == 0) return;
+    memcpy(mqttUpdate.sensorAddress, address, sizeof(address));
+    mqttUpdate.sensorRole = SensorRegistry::findRole(role);
+    mqttUpdate.sensorUpdate = true;
+}
+
+/**
+ * Payload "on" or "off".
+ */
+void onRecorder(const char *payload, unsigned int, byte) {
+    mqttUpdate.recorderOn = MqttPayload::equals(payload, "on");
+    mqttUpdate.recorderUpdate = true;
+}
 
+/**
+ * Payload as Logger::configure takes it, e.g. "mqtt debug" or "sink mqtt".
+ */
+void onLog(const char *payload, unsigned int, byte) {
+    strncpy(mqttUpdate.log, payload, sizeof(mqttUpdate.log) - 1);
+    mqttUpdate.logUpdate = true;
+}
+
+// three topics per floor zone, one per radiator zone and the five shared ones
+constexpr byte MQTT_ZONE_TOPICS = 3 * FLOOR_ZONES_COUNT + RADIATOR_ZONES_COUNT;
+MqttRouter<MQTT_ZONE_TOPICS + 5> mqttRouter;
+
+void messageReceived(MQTTClient *, char topic[], char bytes[], int length) {
+    const char *payload = bytes != nullptr ? bytes : "";
+    LOG_DEBUG(MQTT, "incoming: [%s] - [%s]", topic, payload);
+    inputRecorder.mqtt(topic, payload);
+    mqttRouter.dispatch(topic, payload, static_cast<unsigned int>(length));
 }
 
 class SmartHataMqtt {
 private:
-    static const int MQTT_CONNECTION_TIMEOUT = 3000;
+    static const unsigned int MQTT_COMMAND_TIMEOUT = 500;
+    static const unsigned long RECONNECT_MIN_DELAY = 1000;
+    static const unsigned long RECONNECT_MAX_DELAY = 60000;
 
     WiFiClient net = WiFiClient();
-    MQTTClient mqttClient = MQTTClient();
+    static const int BUFFER_SIZE = 512;
+    // a recorder block with its topic and the MQTT headers
+    static_assert(InputRecorder::PAYLOAD_SIZE + 32 <= BUFFER_SIZE, "recorder blocks do not fit in the MQTT buffer");
+
+    MQTTClient mqttClient = MQTTClient(BUFFER_SIZE);
 
     const char *mqtt_broker;
     const int mqtt_port;
@@ -57,6 +193,17 @@ private:
     const char *mqtt_username;
     const char *mqtt_password;
 
+    char zoneTopics[MQTT_ZONE_TOPICS][InputRecorder::MQTT_TOPIC_MAX + 1]{};
+    byte zoneTopicsCount = 0;
+
+    bool wasConnected = false;
+    byte subscribed = mqttRouter.ROUTES_MAX;
+    Timeout reconnectTimeout = Timeout();
+    unsigned long reconnectDelay = RECONNECT_MIN_DELAY;
+    unsigned long connectedSince = 0;
+    unsigned long connectAttempts = 0;
+    unsigned long connects = 0;
+
 public:
 
     SmartHataMqtt(const char *broker, const int port,
@@ -65,71 +212,105 @@ public:
             mqtt_client_id(client_id), mqtt_username(username), mqtt_password(password) {
 
         mqttClient.begin(mqtt_broker, mqtt_port, net);
-        mqttClient.onMessage(messageReceived);
+        mqttClient.setOptions(10, true, MQTT_COMMAND_TIMEOUT);
+        mqttClient.onMessageAdvanced(messageReceived);
+
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            mqttRouter.on(zoneTopic("/heating/%s/in", FLOOR_ZONES[i].name), onHeatingFloorIn, 1, i);
+        }
+        for (byte i = 0; i < RADIATOR_ZONES_COUNT; ++i) {
+            mqttRouter.on(zoneTopic("/room/%s", RADIATOR_ZONES[i].name), onRoom, 0, i);
+        }
+        mqttRouter.on("/second-of-day", onSecondOfDay);
+        mqttRouter.on("/heating/sensors/in", onSensors, 1);
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            mqttRouter.on(zoneTopic("/heating/%s/pid", FLOOR_ZONES[i].name), onHeatingFloorPid, 1, i);
+            mqttRouter.on(zoneTopic("/heating/%s/curve", FLOOR_ZONES[i].name), onHeatingFloorCurve, 1, i);
+        }
+        mqttRouter.on("/heating/schedule", onHeatingSchedule, 1);
+        mqttRouter.on(InputRecorder::CONTROL_TOPIC, onRecorder, 1);
+        mqttRouter.on(Logger::CONTROL_TOPIC, onLog, 1);
+
+        reconnectTimeout.start(0);
         loop();
     }
 
     void loop() {
         mqttClient.loop();
-        if (mqttUpdate.firmwareUpdate) {
-            doUpdate();
-        }
 
-        if (WiFi.isConnected() && !mqttClient.connected()) {
-            Timeout timeout = Timeout(MQTT_CONNECTION_TIMEOUT);
-            while (!mqttClient.connect(mqtt_client_id, mqtt_username, mqtt_password)) {
-                DEBUG_SH(".");
-                delay(100);
-                if (timeout.isReady()) {
-                    return;
-                }
+        if (mqttClient.connected()) {
+            if (subscribed < mqttRouter.size()) {
+                const MqttRoute &route = mqttRouter.route(subscribed++);
+                subs(route.topic, route.qos);
+            }
+        } else {
+            if (wasConnected) {
+                wasConnected = false;
+                LOG_WARN(MQTT, "connection lost");
+            }
+            if (WiFi.isConnected() && reconnectTimeout.isReady()) {
+                connect();
             }
-
-            Serial.print(F("Subscribing MQTT topic\n"));
-            subs("/heating/floor/in", 1);
-            subs("/room/bedroom");
-            subs("/second-of-day");
         }
     }
 
+    bool isConnected() {
+        return mqttClient.connected();
+    }
+
+    unsigned long getConnectAttempts() const {
+        return connectAttempts;
+    }
+
+    unsigned long getConnects() const {
+        return connects;
+    }
+
+    unsigned long getUptimeSec() {
+        return isConnected() ? (millis() - connectedSince) / 1000 : 0;
+    }
+
     void subs(const char *topic, int qos = 0) {
         if (mqttClient.subscribe(topic, qos)) {
-            Serial.print(F("MQTT topic subscribed!\n"));
+            LOG_DEBUG(MQTT, "subscribed %s", topic);
         } else {
-            Serial.print(F("\n\n\n>>> Subscribe to MQTT topic failed!\n\n\n"));
+            LOG_ERROR(MQTT, "subscribe to %s failed", topic);
         }
     }
 
-    void publish(const char topic[], const char message[], int qos = 0) {
-        if (mqttClient.connected()) {
-            mqttClient.publish(topic, message, false, qos);
-        }
+    bool publish(const char topic[], const char message[], int qos = 0) {
+        return mqttClient.connected() && mqttClient.publish(topic, message, false, qos);
     }
 
-    void publish(const char topic[], const String &message, int qos = 0) {
-        this->publish(topic, message.c_str(), qos);
+    bool publish(const char topic[], const uint8_t *payload, size_t length, int qos = 0) {
+        return mqttClient.connected() &&
+               mqttClient.publish(topic, reinterpret_cast<const char *>(payload), static_cast<int>(length), false, qos);
+    }
+
+private:
+
+    const char *zoneTopic(const char *format, const char *zone) {
+        char *topic = zoneTopics[zoneTopicsCount++];
+        snprintf(topic, sizeof(zoneTopics[0]), format, zone);
+        return topic;
     }
 
-    void doUpdate() {
-        this->publish("/heating/floor/message", "Update smarthata-heating from smarthata.org", 1);
-
-        t_httpUpdate_return ret = ESPhttpUpdate.update(firmware);
-        switch (ret) {
-            case HTTP_UPDATE_FAILED:
-                Serial.print(F("[update] Update failed.\n"));
-                this->publish("/heating/floor/message", "[update] Update failed.", 1);
-                break;
-            case HTTP_UPDATE_NO_UPDATES:
-                Serial.print(F("[update] Update no Update.\n"));
-                this->publish("/heating/floor/message", "[update] Update no Update.", 1);
-                break;
-            case HTTP_UPDATE_OK:
-                this->publish("/heating/floor/message", "[update] Update ok.", 1);
-                Serial.print(F("[update] Update ok.\n")); // may not called we reboot the ESP
-                break;
+    void connect() {
+        connectAttempts++;
+        LOG_DEBUG(MQTT, "connecting to %s:%d", mqtt_broker, mqtt_port);
+        if (mqttClient.connect(mqtt_client_id, mqtt_username, mqtt_password)) {
+            wasConnected = true;
+            connects++;
+            connectedSince = millis();
+            reconnectDelay = RECONNECT_MIN_DELAY;
+            subscribed = 0;
+            LOG_INFO(MQTT, "connected, subscribing");
+            return;
         }
 
-        mqttUpdate.firmwareUpdate = false;
+        unsigned long jitter = static_cast<unsigned long>(random(reconnectDelay / 2));
+        reconnectTimeout.start(reconnectDelay * 3 / 4 + jitter);
+        reconnectDelay = reconnectDelay * 2 < RECONNECT_MAX_DELAY ? reconnectDelay * 2 : RECONNECT_MAX_DELAY;
     }
 
 };
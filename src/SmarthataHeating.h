@@ -1,186 +1,601 @@
 #ifndef SMARTHATA_HEATING_SMARTHATAHEATING_H
 #define SMARTHATA_HEATING_SMARTHATAHEATING_H
 
-#include <ESP8266HTTPClient.h>
-#include <ArduinoJson.h>
 #include <DeviceWiFi.h>
 #include "SmartHataMqtt.h"
 #include "config.h"
 #include "Mixer.h"
 #include "Battery.h"
+#include "TelemetryUploader.h"
+#include "TelemetryLog.h"
+#include "TelemetrySerializer.h"
+#include "TelemetryFrame.h"
+#include "Scheduler.h"
+#include "ControllerSnapshot.h"
+#include "FirmwareUpdater.h"
+#include "InputRecorder.h"
+#include "StatusServer.h"
+#include "MemoryStats.h"
+#include "Log.h"
 
 class SmarthataHeating : public DeviceWiFi {
 private:
 
-    Mixer mixer;
-    Battery battery;
+    // one controller per row of FLOOR_ZONES and RADIATOR_ZONES
+    ZoneControllers<Mixer, FloorZoneConfig, FLOOR_ZONES_COUNT> mixers{FLOOR_ZONES};
+    ZoneControllers<Battery, RadiatorZoneConfig, RADIATOR_ZONES_COUNT> batteries{RADIATOR_ZONES};
     TemperatureSensors sensors;
-    Interval readInterval = Interval(2000);
+    bool hasReading = false;
 
-    HTTPClient http;
-    char buffer[200]{};
-    Interval mqttPublishInterval = Interval(30000);
-    Interval smarthataPostInterval = Interval(30000);
-    Interval narodMonInterval = Interval(300000);
+    enum Endpoint {
+        SMARTHATA, NARODMON, ENDPOINTS_COUNT
+    };
+
+    const UploadEndpoint endpoints[ENDPOINTS_COUNT] = {
+            {"smarthata.org", true,  2000, 10000,  3, 5000},
+            {"narodmon.ru",   false, 2000, 300000, 1, 0},
+    };
+
+    TelemetryUploader uploader = TelemetryUploader(endpoints, ENDPOINTS_COUNT);
+    char buffer[TelemetryUploader::URL_SIZE]{};
+    char message[384]{};
+    Telemetry telemetry;
+
+    // compact encoding of each floor zone's telemetry topic, off until selected
+    TelemetryFrameEncoder encoders[FLOOR_ZONES_COUNT];
+    uint8_t frame[TelemetryFrame::MAX_SIZE]{};
+    static const uint32_t ZONE_FIELDS = 1UL << FLOOR_CORRECTED | 1UL << MIXED_SETPOINT | 1UL << MIXER_POSITION |
+                                        1UL << MIXED | 1UL << COLD;
+
+    static const byte REPLAY_BATCH = 4;
+    TelemetryLog telemetryLog;
+
+    static const unsigned long SNAPSHOT_MAX_AGE = 10UL * 60000;
+    ControllerSnapshot snapshots[FLOOR_ZONES_COUNT];
+    ControllerState states[FLOOR_ZONES_COUNT]{};
+    unsigned long snapshotAt = 0;
+
+    FirmwareUpdater firmwareUpdater;
+    byte reportedProgress = 0;
+
+    Scheduler scheduler;
+
+    StatusBuffer statusBuffer;
+    StatusServer statusServer = StatusServer(statusBuffer);
+    MemoryStats memoryStats;
 
     SmartHataMqtt smartHataMqtt = SmartHataMqtt(mqtt_broker, mqtt_port, mqtt_client_id, mqtt_username, mqtt_password);
 
 public:
     SmarthataHeating(const char *ssid, const char *pass) : DeviceWiFi(ssid, pass, 5000) {
-        readInterval.startWithCurrentTime();
-        mqttPublishInterval.startWithCurrentTimeEnabled();
-        smarthataPostInterval.startWithCurrentTimeEnabled();
-        narodMonInterval.startWithCurrentTimeEnabled();
-        smartHataMqtt.publish("/messages", "smarthata-heating started", 1);
+        scheduler.add("relays", PRIORITY_CRITICAL, 0, 0, 1000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->loopRelays(); }, this);
+        scheduler.add("sensors", PRIORITY_CONTROL, 0, 0, 20000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->readSensors(); }, this);
+        scheduler.add("conversion", PRIORITY_CONTROL, 2000, 100, 5000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->sensors.startConversion(); }, this);
+        scheduler.add("battery", PRIORITY_CONTROL, 0, 100, 1000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->loopBatteries(); }, this);
+        scheduler.add("wifi", PRIORITY_NORMAL, 0, 0, 50000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->DeviceWiFi::loop(); }, this);
+        scheduler.add("mqtt", PRIORITY_NORMAL, 0, 0, 50000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->smartHataMqtt.loop(); }, this);
+        scheduler.add("commands", PRIORITY_NORMAL, 0, 0, 20000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->handleCommands(); }, this);
+        scheduler.add("ota", PRIORITY_NORMAL, 0, 0, 50000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->updateFirmware(); }, this);
+        scheduler.add("publish", PRIORITY_NORMAL, 30000, 2000, 20000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->publishTelemetry(); }, this);
+        scheduler.add("smarthata", PRIORITY_BACKGROUND, 30000, 5000, 5000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->postDataToSmarthata(); }, this);
+        scheduler.add("narodmon", PRIORITY_BACKGROUND, 300000, 30000, 5000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->postDataToNarodMon(); }, this);
+        scheduler.add("replay", PRIORITY_BACKGROUND, 2000, 2000, 50000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->replayTelemetry(); }, this);
+        scheduler.add("upload", PRIORITY_BACKGROUND, 0, 0, 2000000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->upload(); }, this);
+        scheduler.add("clock", PRIORITY_BACKGROUND, 1000, 1000, 5000,
+                      [](void *) { localClock.loop(); }, this);
+        scheduler.add("snapshot", PRIORITY_BACKGROUND, 10000, 10000, 50000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->saveSnapshotIfDue(); }, this);
+        scheduler.add("metrics", PRIORITY_BACKGROUND, 600000, 60000, 20000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->publishMetrics(); }, this);
+        scheduler.add("http", PRIORITY_NORMAL, 0, 0, 20000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->statusServer.loop(); }, this);
+        scheduler.add("status", PRIORITY_BACKGROUND, 1000, 1000, 2000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->updateStatus(); }, this);
+        scheduler.add("recorder", PRIORITY_BACKGROUND, 1000, 1000, 5000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->publishRecording(); }, this);
+        scheduler.add("log", PRIORITY_BACKGROUND, 0, 0, 2000,
+                      [](void *self) { static_cast<SmarthataHeating *>(self)->drainLog(); }, this);
+
+        bool restored = true;
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            bool found = snapshots[i].begin(i, states[i]);
+            mixers[i].begin(found ? &states[i] : nullptr);
+            restored = restored && found;
+        }
+        snapshotAt = millis();
+
+        localClock.begin(ntp_server, time_zone_offset);
+        weeklySchedule.begin();
+        telemetryLog.begin();
+        statusServer.begin();
+        smartHataMqtt.publish("/messages", restored ? "smarthata-heating started, state restored"
+                                                    : "smarthata-heating started, homing mixer", 1);
     }
 
     void loop() override {
-        DeviceWiFi::loop();
-        mixer.loop();
-        battery.loop();
-        smartHataMqtt.loop();
-
-        if (mqttUpdate.floorTempUpdate) {
-            String message;
-            if (mqttUpdate.floorTemp >= 10 && mqttUpdate.floorTemp <= 35) {
-                mixer.floorTemp = mqttUpdate.floorTemp;
-                message = String("Setup new floorTemp [") + mqttUpdate.floorTemp + "]";
+        scheduler.loop();
+    }
+
+    /**
+     * @return energized relays, bits 2i and 2i+1 for the up and down relay of floor zone i,
+     * then one bit per radiator zone pump
+     */
+    uint16_t outputs() const {
+        uint16_t mask = 0;
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            mask |= mixers[i].getRelayState() << (2 * i);
+        }
+        for (byte i = 0; i < RADIATOR_ZONES_COUNT; ++i) {
+            if (batteries[i].isPumpOn()) mask |= 1 << (2 * FLOOR_ZONES_COUNT + i);
+        }
+        return mask;
+    }
+
+private:
+
+    void handleCommands() {
+        if (mqttUpdate.restart) {
+            // a run only counts into the position once it ends
+            for (Mixer &mixer : mixers) mixer.stopValve();
+            saveSnapshot();
+            ESP.restart();
+            mqttUpdate.restart = false;
+        }
+
+        if (mqttUpdate.firmwareUpdate) {
+            mqttUpdate.firmwareUpdate = false;
+            smartHataMqtt.publish("/heating/floor/message", "[update] Update smarthata-heating from smarthata.org", 1);
+            reportedProgress = 0;
+            firmwareUpdater.start(firmware);
+        }
+
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            handleZoneCommands(mixers[i], mqttUpdate.floors[i], encoders[i]);
+        }
+
+        if (mqttUpdate.scheduleUpdate) {
+            if (mqttUpdate.scheduleTooLong) {
+                smartHataMqtt.publish("/messages", "Schedule too long", 1);
             } else {
-                message = String("Bad request temp [") + mqttUpdate.floorTemp + "]";
+                bool applied = weeklySchedule.configure(mqttUpdate.schedule);
+                smartHataMqtt.publish("/messages", applied ? "Schedule applied" : "Bad schedule", 1);
+            }
+            mqttUpdate.scheduleUpdate = false;
+        }
+
+        if (mqttUpdate.sensorUpdate) {
+            bool assigned = mqttUpdate.sensorRole >= 0 &&
+                            sensors.assign(static_cast<SensorRole>(mqttUpdate.sensorRole), mqttUpdate.sensorAddress);
+            smartHataMqtt.publish("/messages", assigned ? "Sensor assigned" : "Bad sensor assignment", 1);
+            mqttUpdate.sensorUpdate = false;
+        }
+
+        if (mqttUpdate.recorderUpdate) {
+            mqttUpdate.recorderUpdate = false;
+            if (mqttUpdate.recorderOn) {
+                startRecording();
+            } else {
+                inputRecorder.stop();
+            }
+            smartHataMqtt.publish("/messages", inputRecorder.isEnabled() ? "Recorder on" : "Recorder off", 1);
+        }
+
+        if (mqttUpdate.logUpdate) {
+            mqttUpdate.logUpdate = false;
+            smartHataMqtt.publish("/messages", logger.configure(mqttUpdate.log) ? "Log configured" : "Bad log command", 1);
+        }
+    }
+
+    /**
+     * The recording starts with the state of every floor zone, so a replay can begin where the controller was.
+     */
+    void startRecording() {
+        inputRecorder.start();
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            if (mixers[i].isHoming()) continue;
+            ControllerState state = states[i];
+            mixers[i].snapshot(state);
+            inputRecorder.state(i, state);
+        }
+        inputRecorder.outputs(outputs());
+    }
+
+    /**
+     * Copies the state the status endpoint serves, between tasks so it is never half updated.
+     */
+    void updateStatus() {
+        memoryStats.sample();
+        HeatingStatus &status = statusBuffer.beginWrite();
+        status.uptimeSec = millis() / 1000;
+        status.mqttConnected = smartHataMqtt.isConnected() ? 1 : 0;
+        status.mqttConnectAttempts = smartHataMqtt.getConnectAttempts();
+        status.mqttConnects = smartHataMqtt.getConnects();
+        status.telemetryBacklog = telemetryLog.getBacklog();
+        status.recorderDropped = inputRecorder.getDropped();
+        status.httpRequests = statusServer.getRequests();
+        status.heapFree = memoryStats.getHeapFree();
+        status.heapFreeMin = memoryStats.getHeapFreeMin();
+        status.heapMaxBlock = memoryStats.getMaxBlock();
+        status.heapMaxBlockMin = memoryStats.getMaxBlockMin();
+        status.heapFragmentation = memoryStats.getFragmentation();
+        status.heapFragmentationMax = memoryStats.getFragmentationMax();
+        status.stackFreeMin = memoryStats.getStackFree();
+        status.logDropped = logger.getDropped();
+        status.dto = sensors.getTemperatures();
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            const Mixer &mixer = mixers[i];
+            FloorZoneStatus &floor = status.floors[i];
+            floor.floorTemp = mixer.floorTemp;
+            floor.floorTempCorrected = mixer.floorTempCorrected;
+            floor.mixedSetpoint = mixer.mixedSetpoint;
+            floor.valueSec = static_cast<float>(mixer.valueSec);
+            floor.position = mixer.getMixerPositionPercentage();
+            floor.travelSec = mixer.getTravelMs() / 1000.0f;
+        }
+        for (byte i = 0; i < RADIATOR_ZONES_COUNT; ++i) {
+            const Battery &battery = batteries[i];
+            RadiatorZoneStatus &room = status.rooms[i];
+            room.roomTemp = battery.getRoomTemp();
+            room.expected = battery.expectedRoomTemp;
+            room.target = battery.targetTemp;
+            room.pump = battery.isPumpOn() ? 1 : 0;
+            room.stale = battery.isStale() ? 1 : 0;
+        }
+        statusBuffer.commit();
+    }
+
+    void publishRecording() {
+        const char *block = inputRecorder.takeBlock();
+        if (block != nullptr) smartHataMqtt.publish(InputRecorder::TOPIC, block);
+    }
+
+    /**
+     * Log lines wait in the ring while the broker is away.
+     */
+    void drainLog() {
+        if (logger.getSink() == LOG_TO_SERIAL) {
+            logger.drain(Serial);
+        } else if (smartHataMqtt.isConnected() && logger.takeBatch(message, sizeof(message))) {
+            smartHataMqtt.publish(Logger::TOPIC, message);
+        }
+    }
+
+    void handleZoneCommands(Mixer &mixer, FloorZoneUpdate &floor, TelemetryFrameEncoder &encoder) {
+        if (floor.floorTempUpdate) {
+            if (floor.floorTemp >= 10 && floor.floorTemp <= 35) {
+                mixer.floorTemp = floor.floorTemp;
+                snprintf(message, sizeof(message), "Setup new floorTemp [%.2f]", floor.floorTemp);
+            } else {
+                snprintf(message, sizeof(message), "Bad request temp [%.2f]", floor.floorTemp);
             }
             smartHataMqtt.publish("/messages", message, 1);
-            mqttUpdate.floorTempUpdate = false;
+            floor.floorTempUpdate = false;
+        }
+
+        if (floor.encodingUpdate) {
+            encoder.setEnabled(floor.compact);
+            smartHataMqtt.publish("/messages", floor.compact ? "Compact telemetry on" : "JSON telemetry on", 1);
+            floor.encodingUpdate = false;
         }
 
-        if (readInterval.isReady()) {
-            const SmartHeatingDto &dto = sensors.updateTemperatures();
-            mixer.checkMixer(dto);
+        if (floor.calibrate) {
+            mixer.startCalibration();
+            smartHataMqtt.publish("/messages", "Mixer calibration started", 1);
+            floor.calibrate = false;
+        }
 
-            if (mqttPublishInterval.isReady()) {
-                publish(dto);
+        if (floor.autotune) {
+            smartHataMqtt.publish("/messages", mixer.startAutotune() ? "Mixer autotune started"
+                                                                     : "Mixer autotune refused, mixer busy", 1);
+            floor.autotune = false;
+        }
+        if (mixer.takeAutotuneReport(message, sizeof(message))) {
+            smartHataMqtt.publish("/messages", message, 1);
+        }
+
+        if (floor.tuningUpdate) {
+            if (floor.tuningTooLong) {
+                smartHataMqtt.publish("/messages", "Mixer tuning too long", 1);
+            } else {
+                byte applied = mixer.configure(floor.tuning);
+                smartHataMqtt.publish("/messages", applied > 0 ? "Mixer tuning applied" : "Bad mixer tuning", 1);
             }
+            floor.tuningUpdate = false;
+        }
 
-            if (TemperatureSensors::isValidTemp(dto.streetTemp)) {
-                if (narodMonInterval.isReady()) {
-                    postDataToNarodMon(dto);
-                }
+        if (floor.curveUpdate) {
+            if (floor.curveTooLong) {
+                snprintf(message, sizeof(message), "Heating curve too long");
+            } else if (mixer.configureCurve(floor.curve)) {
+                char curve[96];
+                mixer.printCurve(curve, sizeof(curve));
+                snprintf(message, sizeof(message), "Heating curve applied [%s]", curve);
+            } else {
+                snprintf(message, sizeof(message), "Bad heating curve [%s]", floor.curve);
             }
+            smartHataMqtt.publish("/messages", message, 1);
+            floor.curveUpdate = false;
+        }
+    }
 
-            if (smarthataPostInterval.isReady()) {
-                postDataToSmarthata(dto);
+    /**
+     * Streams the image while control keeps running. The mixer relays are switched off and
+     * the state is saved only for the final checksum check and commit.
+     */
+    void updateFirmware() {
+        firmwareUpdater.loop();
+        switch (firmwareUpdater.getState()) {
+            case FirmwareUpdater::UPDATE_DOWNLOADING:
+                if (firmwareUpdater.getProgress() >= reportedProgress + 10) {
+                    reportedProgress = firmwareUpdater.getProgress() / 10 * 10;
+                    snprintf(message, sizeof(message), "[update] %u%% (%u/%u)", reportedProgress,
+                             (unsigned int) firmwareUpdater.getWritten(), (unsigned int) firmwareUpdater.getTotal());
+                    smartHataMqtt.publish("/heating/floor/message", message);
+                }
+                break;
+            case FirmwareUpdater::UPDATE_DOWNLOADED:
+                for (Mixer &mixer : mixers) mixer.stopValve();
+                saveSnapshot();
+                if (firmwareUpdater.commit()) {
+                    smartHataMqtt.publish("/heating/floor/message", "[update] Update ok, restarting", 1);
+                    ESP.restart();
+                }
+                break;
+            case FirmwareUpdater::UPDATE_FAILED:
+                snprintf(message, sizeof(message), "[update] Update failed: %s", firmwareUpdater.getError());
+                LOG_ERROR(HEATING, "%s", message);
+                smartHataMqtt.publish("/heating/floor/message", message, 1);
+                firmwareUpdater.reset();
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Waits for every valve to stop, a save during a run would keep the position from before it.
+     */
+    void saveSnapshotIfDue() {
+        bool due = millis() - snapshotAt >= SNAPSHOT_MAX_AGE;
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            if (mixers[i].isValveMoving()) return;
+            due = due || mixers[i].hasMovedSince(states[i]);
+        }
+        if (due) saveSnapshot();
+    }
+
+    void saveSnapshot() {
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            mixers[i].snapshot(states[i]);
+            snapshots[i].save(states[i]);
+        }
+        snapshotAt = millis();
+    }
+
+    /**
+     * The HTTP client blocks for up to an endpoint's timeout, so nothing is sent while a valve
+     * runs and its relay cut-off is due.
+     */
+    void upload() {
+        for (const Mixer &mixer : mixers) {
+            if (mixer.isValveMoving()) return;
+        }
+        uploader.loop();
+    }
+
+    void loopRelays() {
+        for (Mixer &mixer : mixers) mixer.loop();
+        inputRecorder.outputs(outputs());
+    }
+
+    void loopBatteries() {
+        for (Battery &battery : batteries) battery.loop();
+    }
+
+    /**
+     * One sensor pass feeds every floor zone, each with the room of its radiator zone.
+     */
+    void readSensors() {
+        if (!sensors.loop()) return;
+
+        for (byte i = 0; i < FLOOR_ZONES_COUNT; ++i) {
+            Mixer &mixer = mixers[i];
+            int8_t room = FLOOR_ZONES[i].room;
+            if (room >= 0 && !batteries[room].isStale()) {
+                mixer.roomTemp = batteries[room].getRoomTemp();
+                mixer.roomTempExpected = batteries[room].expectedRoomTemp;
+            } else {
+                mixer.roomTemp = mixer.roomTempExpected = DEVICE_DISCONNECTED_C;
             }
+            mixer.checkMixer(sensors.getTemperatures());
         }
+        hasReading = true;
+    }
 
+    void publishTelemetry() {
+        if (!hasReading) return;
+        if (smartHataMqtt.isConnected()) {
+            publish(sensors.getTemperatures());
+        } else {
+            storeTelemetry(sensors.getTemperatures());
+        }
     }
 
-private:
+    /**
+     * Publishes the worst relay cut-off delay, the run time histogram of the whole loop and the
+     * scheduler statistics of the last period on /heating/metrics, in as few messages of whole
+     * lines as they need, then starts a new period.
+     */
+    void publishMetrics() {
+        unsigned long cutoffLateMaxMs = 0;
+        for (Mixer &mixer : mixers) {
+            unsigned long late = mixer.takeCutoffLateMaxMs();
+            if (late > cutoffLateMaxMs) cutoffLateMaxMs = late;
+        }
+        int length = snprintf(message, sizeof(message), "relay-cutoff %lu\n", cutoffLateMaxMs);
+        length += scheduler.getPasses().toLine("loop", message + length, sizeof(message) - length);
+        byte next = scheduler.report(message + length, sizeof(message) - length);
+        smartHataMqtt.publish("/heating/metrics", message);
+        while (next < scheduler.size()) {
+            byte from = next;
+            next = scheduler.report(message, sizeof(message), from);
+            if (next == from) break;
+            smartHataMqtt.publish("/heating/metrics", message);
+        }
+        scheduler.resetStats();
+
+        for (Battery &battery : batteries) {
+            battery.takeStats(message, sizeof(message));
+            smartHataMqtt.publish("/heating/battery", message);
+        }
+
+        memoryStats.takeReport(message, sizeof(message));
+        smartHataMqtt.publish("/heating/memory", message);
+    }
+
+    /**
+     * The telemetry fields carry the first floor and radiator zone, so the stored records and
+     * the uploads keep their single-zone format. Further zones go to publishZones().
+     */
+    const Telemetry &collectTelemetry(const SmartHeatingDto &dto) {
+        const Mixer &mixer = mixers[0];
+        const Battery &battery = batteries[0];
+        telemetry[FLOOR] = mixer.floorTemp;
+        telemetry[FLOOR_CORRECTED] = mixer.floorTempCorrected;
+        telemetry[MIXER_POSITION] = mixer.getMixerPositionPercentage();
+        telemetry[MIXER_VALUE_SEC] = static_cast<float>(mixer.valueSec);
+        telemetry[MIXER_TRAVEL] = mixer.getTravelMs() / 1000.0f;
+        telemetry[MIXED_SETPOINT] = mixer.mixedSetpoint;
+        telemetry[MQTT_ATTEMPTS] = smartHataMqtt.getConnectAttempts();
+        telemetry[MQTT_UPTIME] = smartHataMqtt.getUptimeSec();
+        telemetry[UPTIME] = millis() / 1000;
+        telemetry[MIXED] = dto.temp(FLOOR_ZONES[0].mixedRole);
+        telemetry[COLD] = dto.temp(FLOOR_ZONES[0].coldRole);
+        telemetry[HOT] = dto.temp(ROLE_HOT);
+        telemetry[STREET] = dto.temp(ROLE_STREET);
+        telemetry[BATTERY] = dto.temp(ROLE_BATTERY);
+        telemetry[BOILER] = dto.temp(ROLE_BOILER);
+        telemetry[BEDROOM] = battery.getRoomTemp();
+        telemetry[BEDROOM_EXPECTED] = battery.expectedRoomTemp;
+        telemetry[BATTERY_POMP] = battery.getBatteryPompState();
+        telemetry[STALE_SENSORS] = dto.staleMask;
+        return telemetry;
+    }
 
     void publish(const SmartHeatingDto &dto) {
-        DynamicJsonBuffer jsonBuffer;
-
-        JsonObject &root = jsonBuffer.createObject();
-        root["floor-corrected"] = mixer.floorTempCorrected;
-        root["mixer-position"] = mixer.getMixerPositionPercentage();
-        root["mixer-pid-value-sec"] = mixer.valueSec;
-        addTime(root);
-        publish(root);
-
-        jsonBuffer.clear();
-        JsonObject &root2 = jsonBuffer.createObject();
-        if (TemperatureSensors::isValidTemp(dto.floorMixedTemp)) root2["mixed"] = dto.floorMixedTemp;
-        if (TemperatureSensors::isValidTemp(dto.floorColdTemp)) root2["cold"] = dto.floorColdTemp;
-        if (TemperatureSensors::isValidTemp(dto.heatingHotTemp)) root2["hot"] = dto.heatingHotTemp;
-        if (TemperatureSensors::isValidTemp(dto.streetTemp)) root2["street"] = dto.streetTemp;
-        if (TemperatureSensors::isValidTemp(dto.batteryColdTemp)) root2["battery"] = dto.batteryColdTemp;
-        if (TemperatureSensors::isValidTemp(dto.boilerTemp)) root2["boiler"] = dto.boilerTemp;
-        publish(root2);
-
-        jsonBuffer.clear();
-        JsonObject &root3 = jsonBuffer.createObject();
-        root3["bedroom-temp"] = mqttUpdate.bedroomTemp;
-        root3["bedroom-temp-expected"] = battery.expectedBedroomTemp;
-        root3["battery-pomp"] = battery.getBatteryPompState();
-        publish(root3);
-    }
-
-    void addTime(JsonObject &root) {
-        unsigned long sec = millis() / 1000;
-        unsigned long mins = sec / 60;
-        unsigned long hours = mins / 60;
-        unsigned long days = hours / 24;
-        sec %= 60;
-        mins %= 60;
-        hours %= 24;
-        if (days > 0) {
-            root["days"] = days;
-        } else if (hours > 0) {
-            root["hours"] = hours;
-        } else if (mins > 0) {
-            root["mins"] = mins;
+        if (encoders[0].isEnabled()) {
+            size_t length = encoders[0].encode(collectTelemetry(dto), TelemetryFrame::ALL_FIELDS, frame);
+            smartHataMqtt.publish("/heating/floor", frame, length);
         } else {
-            root["sec"] = sec;
-        }
-    }
-
-    void publish(const JsonObject &root) {
-        String message;
-        root.printTo(message);
-        Serial.println(message);
-        smartHataMqtt.publish("/heating/floor", message);
-    }
-
-    void postDataToSmarthata(const SmartHeatingDto &dto) {
-        sprintf(buffer,
-                "http://smarthata.org/api/devices/1/measures?floor=%1.1f&corrected=%1.1f&mixer-pid-value-sec=%1.1f&mixer-position=%d&bedroom-temp-expected=%1.1f&battery-pomp=%d",
-                mixer.floorTemp,
-                mixer.floorTempCorrected,
-                mixer.valueSec,
-                mixer.getMixerPositionPercentage(),
-                battery.expectedBedroomTemp,
-                battery.getBatteryPompState()
-        );
-        makeHttpPostRequest();
-        sprintf(buffer,
-                "http://smarthata.org/api/devices/1/measures?mixed=%1.1f&cold=%1.1f&battery=%1.1f&heating=%1.1f&boiler=%1.1f&street=%1.1f",
-                dto.floorMixedTemp,
-                dto.floorColdTemp,
-                dto.batteryColdTemp,
-                dto.heatingHotTemp,
-                dto.boilerTemp,
-                dto.streetTemp
-        );
-        makeHttpPostRequest();
-    }
-
-    int postDataToNarodMon(const SmartHeatingDto &dto) {
-        Serial.println("Send data to narodmon.ru");
-        sprintf(buffer,
-                "http://narodmon.ru/get?ID=%s&corrected=%1.1f&mixed=%1.1f&street=%1.1f",
-                NARODMON_MAC,
-                mixer.floorTempCorrected,
-                dto.floorMixedTemp,
-                dto.streetTemp
-        );
-        return makeHttpGetRequest();
-    }
-
-    int makeHttpPostRequest(int retryCount = 1) {
-        http.begin(buffer);
-        int code = http.POST("");
-        http.end();
-
-        if (code < 0 && retryCount > 0) {
-            return makeHttpPostRequest(retryCount - 1);
-        }
-
-        return code;
-    }
-
-    int makeHttpGetRequest() {
-        http.begin(buffer);
-        int code = http.GET();
-        http.end();
-        return code;
+            TelemetrySerializer::toJson(collectTelemetry(dto), message, sizeof(message));
+            LOG_DEBUG(HEATING, "%s", message);
+            smartHataMqtt.publish("/heating/floor", message);
+        }
+        publishZones(dto);
+    }
+
+    /**
+     * Publishes the zones after the first ones on "/heating/<name>", a floor zone in compact
+     * encoding carries the ZONE_FIELDS of its JSON document.
+     */
+    void publishZones(const SmartHeatingDto &dto) {
+        char topic[32];
+        for (byte i = 1; i < FLOOR_ZONES_COUNT; ++i) {
+            Mixer &mixer = mixers[i];
+            snprintf(topic, sizeof(topic), "/heating/%s", mixer.getName());
+            if (encoders[i].isEnabled()) {
+                Telemetry zone;
+                zone[FLOOR_CORRECTED] = mixer.floorTempCorrected;
+                zone[MIXED_SETPOINT] = mixer.mixedSetpoint;
+                zone[MIXER_POSITION] = mixer.getMixerPositionPercentage();
+                zone[MIXED] = dto.temp(FLOOR_ZONES[i].mixedRole);
+                zone[COLD] = dto.temp(FLOOR_ZONES[i].coldRole);
+                smartHataMqtt.publish(topic, frame, encoders[i].encode(zone, ZONE_FIELDS, frame));
+                continue;
+            }
+            snprintf(message, sizeof(message),
+                     "{\"floor-corrected\":%.2f,\"mixed-setpoint\":%.1f,\"mixer-position\":%u,"
+                     "\"mixed\":%.2f,\"cold\":%.2f}",
+                     mixer.floorTempCorrected, mixer.mixedSetpoint, mixer.getMixerPositionPercentage(),
+                     dto.temp(FLOOR_ZONES[i].mixedRole), dto.temp(FLOOR_ZONES[i].coldRole));
+            smartHataMqtt.publish(topic, message);
+        }
+        for (byte i = 1; i < RADIATOR_ZONES_COUNT; ++i) {
+            Battery &battery = batteries[i];
+            snprintf(topic, sizeof(topic), "/heating/%s", battery.getName());
+            snprintf(message, sizeof(message), "{\"room-temp\":%.2f,\"room-temp-expected\":%.1f,\"pomp\":%d}",
+                     battery.getRoomTemp(), battery.expectedRoomTemp, battery.getBatteryPompState());
+            smartHataMqtt.publish(topic, message);
+        }
+    }
+
+    void storeTelemetry(const SmartHeatingDto &dto) {
+        TelemetryRecord record{};
+        TelemetrySerializer::toRecord(collectTelemetry(dto), record);
+        telemetryLog.append(record);
+    }
+
+    /**
+     * Publishes stored records as CSV: a "boot,uptime" line for the current time,
+     * then one "boot,uptime,mixed,cold,hot,battery,boiler,street,corrected,value,position,bedroom,expected,pomp"
+     * line per record, temperatures in 1/100 C and the PID value in 1/10 s.
+     */
+    void replayTelemetry() {
+        if (!smartHataMqtt.isConnected()) return;
+
+        TelemetryRecord records[REPLAY_BATCH];
+        byte count = telemetryLog.readBacklog(records, REPLAY_BATCH);
+        if (count == 0) return;
+
+        char payload[REPLAY_BATCH * 96 + 16];
+        int length = snprintf(payload, sizeof(payload), "%u,%lu\n", telemetryLog.getBoot(), millis() / 1000);
+        for (byte i = 0; i < count; ++i) {
+            const TelemetryRecord &r = records[i];
+            length += snprintf(payload + length, sizeof(payload) - length,
+                               "%u,%lu,%d,%d,%d,%d,%d,%d,%d,%d,%u,%d,%d,%u\n",
+                               r.boot, (unsigned long) r.uptimeSec,
+                               r.temps[0], r.temps[1], r.temps[2], r.temps[3], r.temps[4], r.temps[5],
+                               r.floorTempCorrected, r.mixerValueDeciSec, r.mixerPositionAndPomp & 0x7F,
+                               r.bedroomTemp, r.bedroomTempExpected, r.mixerPositionAndPomp >> 7);
+        }
+        if (smartHataMqtt.publish("/heating/floor/backlog", payload)) {
+            telemetryLog.markReplayed(records[count - 1]);
+        }
+    }
+
+    void postDataToSmarthata() {
+        if (!hasReading) return;
+        postData(SMARTHATA, "http://smarthata.org/api/devices/1/measures?", SMARTHATA_QUERY, sensors.getTemperatures());
+    }
+
+    void postDataToNarodMon() {
+        const SmartHeatingDto &dto = sensors.getTemperatures();
+        if (!hasReading || !TemperatureSensors::isValidTemp(dto.temp(ROLE_STREET))) return;
+
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "http://narodmon.ru/get?ID=%s&", NARODMON_MAC);
+        postData(NARODMON, prefix, NARODMON_QUERY, dto);
+    }
+
+    void postData(Endpoint endpoint, const char *prefix, TelemetrySink sink, const SmartHeatingDto &dto) {
+        size_t length = strlen(prefix);
+        if (length >= sizeof(buffer)) return;
+        memcpy(buffer, prefix, length);
+        TelemetrySerializer::toQuery(collectTelemetry(dto), sink, buffer + length, sizeof(buffer) - length);
+        uploader.enqueue(endpoint, buffer);
     }
 
 };
@@ -0,0 +1,345 @@
+#ifndef SMARTHATA_HEATING_STATUSSERVER_H
+#define SMARTHATA_HEATING_STATUSSERVER_H
+
+#include <ESP8266WiFi.h>
+#include "TemperatureSensors.h"
+#include "Zones.h"
+
+struct FloorZoneStatus {
+    float floorTemp;
+    float floorTempCorrected;
+    float mixedSetpoint;
+    float valueSec;
+    float position;
+    float travelSec;
+};
+
+struct RadiatorZoneStatus {
+    float roomTemp;
+    float expected;
+    float target;
+    float pump;
+    float stale;
+};
+
+/**
+ * Everything the status endpoint shows, copied from the controllers in one pass.
+ */
+struct HeatingStatus {
+    uint32_t uptimeSec;
+    uint32_t mqttConnected;
+    uint32_t mqttConnectAttempts;
+    uint32_t mqttConnects;
+    uint32_t telemetryBacklog;
+    uint32_t recorderDropped;
+    uint32_t httpRequests;
+    uint32_t heapFree;
+    uint32_t heapFreeMin;
+    uint32_t heapMaxBlock;
+    uint32_t heapMaxBlockMin;
+    uint32_t heapFragmentation;
+    uint32_t heapFragmentationMax;
+    uint32_t stackFreeMin;
+    uint32_t logDropped;
+
+    SmartHeatingDto dto;
+    FloorZoneStatus floors[FLOOR_ZONES_COUNT];
+    RadiatorZoneStatus rooms[RADIATOR_ZONES_COUNT];
+};
+
+/**
+ * Two HeatingStatus copies, the control side fills one while the other is served. A response
+ * spans several loop passes, so the reader pins its copy and the writer keeps off it.
+ */
+class StatusBuffer {
+private:
+    HeatingStatus buffers[2]{};
+    byte active = 0;
+    byte writing = 0;
+    int8_t pinned = -1;
+
+public:
+
+    HeatingStatus &beginWrite() {
+        writing = pinned == (active ^ 1) ? active : active ^ 1;
+        return buffers[writing];
+    }
+
+    void commit() {
+        active = writing;
+    }
+
+    const HeatingStatus &pin() {
+        pinned = active;
+        return buffers[active];
+    }
+
+    void unpin() {
+        pinned = -1;
+    }
+};
+
+struct StatusMetric {
+    const char *name;
+    size_t offset;
+};
+
+constexpr StatusMetric DEVICE_METRICS[] = {
+        {"heating_uptime_seconds",                  offsetof(HeatingStatus, uptimeSec)},
+        {"heating_mqtt_connected",                  offsetof(HeatingStatus, mqttConnected)},
+        {"heating_mqtt_connect_attempts_total",     offsetof(HeatingStatus, mqttConnectAttempts)},
+        {"heating_mqtt_connects_total",             offsetof(HeatingStatus, mqttConnects)},
+        {"heating_telemetry_backlog",               offsetof(HeatingStatus, telemetryBacklog)},
+        {"heating_recorder_dropped_total",          offsetof(HeatingStatus, recorderDropped)},
+        {"heating_http_requests_total",             offsetof(HeatingStatus, httpRequests)},
+        {"heating_heap_free_bytes",                 offsetof(HeatingStatus, heapFree)},
+        {"heating_heap_free_min_bytes",             offsetof(HeatingStatus, heapFreeMin)},
+        {"heating_heap_max_block_bytes",            offsetof(HeatingStatus, heapMaxBlock)},
+        {"heating_heap_max_block_min_bytes",        offsetof(HeatingStatus, heapMaxBlockMin)},
+        {"heating_heap_fragmentation_percent",      offsetof(HeatingStatus, heapFragmentation)},
+        {"heating_heap_fragmentation_max_percent",  offsetof(HeatingStatus, heapFragmentationMax)},
+        {"heating_stack_free_min_bytes",            offsetof(HeatingStatus, stackFreeMin)},
+        {"heating_log_dropped_total",               offsetof(HeatingStatus, logDropped)},
+};
+
+constexpr StatusMetric FLOOR_METRICS[] = {
+        {"heating_floor_target_celsius",    offsetof(FloorZoneStatus, floorTemp)},
+        {"heating_floor_corrected_celsius", offsetof(FloorZoneStatus, floorTempCorrected)},
+        {"heating_mixed_setpoint_celsius",  offsetof(FloorZoneStatus, mixedSetpoint)},
+        {"heating_mixer_value_seconds",     offsetof(FloorZoneStatus, valueSec)},
+        {"heating_mixer_position_percent",  offsetof(FloorZoneStatus, position)},
+        {"heating_mixer_travel_seconds",    offsetof(FloorZoneStatus, travelSec)},
+};
+
+constexpr StatusMetric ROOM_METRICS[] = {
+        {"heating_room_celsius",          offsetof(RadiatorZoneStatus, roomTemp)},
+        {"heating_room_expected_celsius", offsetof(RadiatorZoneStatus, expected)},
+        {"heating_room_target_celsius",   offsetof(RadiatorZoneStatus, target)},
+        {"heating_pump_on",               offsetof(RadiatorZoneStatus, pump)},
+        {"heating_room_stale",            offsetof(RadiatorZoneStatus, stale)},
+};
+
+/**
+ * Serves the pinned HeatingStatus as Prometheus text on GET / and GET /metrics. One client at
+ * a time; each loop() reads what the request has sent or writes the lines the socket takes,
+ * so a slow client never holds the control loop.
+ */
+class StatusServer {
+public:
+    static const uint16_t PORT = 80;
+    static const unsigned long TIMEOUT_MS = 3000;
+
+private:
+    enum State {
+        SERVER_IDLE, SERVER_READING, SERVER_WRITING
+    };
+
+    WiFiServer server = WiFiServer(PORT);
+    WiFiClient client;
+    StatusBuffer &buffer;
+
+    State state = SERVER_IDLE;
+    unsigned long startedAt = 0;
+    char request[32]{};
+    byte requestLength = 0;
+    bool requestLine = true;
+    byte headerLength = 0;
+    bool found = false;
+    unsigned long requests = 0;
+
+    const HeatingStatus *status = nullptr;
+    byte family = 0;
+    byte item = 0;
+    char line[96]{};
+    size_t lineLength = 0;
+    size_t linePosition = 0;
+
+public:
+
+    explicit StatusServer(StatusBuffer &buffer) : buffer(buffer) {}
+
+    void begin() {
+        server.begin();
+    }
+
+    void loop() {
+        switch (state) {
+            case SERVER_IDLE:
+                client = server.available();
+                if (!client) return;
+                requests++;
+                startedAt = millis();
+                requestLength = 0;
+                requestLine = true;
+                headerLength = 0;
+                state = SERVER_READING;
+                readRequest();
+                break;
+            case SERVER_READING:
+                readRequest();
+                break;
+            case SERVER_WRITING:
+                writeResponse();
+                break;
+        }
+    }
+
+    unsigned long getRequests() const {
+        return requests;
+    }
+
+private:
+
+    /**
+     * Keeps the start of the request line and waits for the empty line ending the headers.
+     */
+    void readRequest() {
+        bool complete = false;
+        while (!complete && client.available() > 0) {
+            char c = static_cast<char>(client.read());
+            if (c == '\r') continue;
+            if (c == '\n') {
+                complete = !requestLine && headerLength == 0;
+                requestLine = false;
+                headerLength = 0;
+            } else {
+                if (requestLine && requestLength < sizeof(request) - 1) request[requestLength++] = c;
+                if (headerLength < 255) headerLength++;
+            }
+        }
+        request[requestLength] = '\0';
+
+        if (complete || (!requestLine && !client.connected())) {
+            found = isStatusPath(request);
+            status = &buffer.pin();
+            family = 0;
+            item = 0;
+            lineLength = linePosition = 0;
+            state = SERVER_WRITING;
+            writeResponse();
+        } else if (!client.connected() || millis() - startedAt >= TIMEOUT_MS) {
+            close();
+        }
+    }
+
+    static bool isStatusPath(const char *requestLine) {
+        if (strncmp(requestLine, "GET ", 4) != 0) return false;
+        const char *path = requestLine + 4;
+        const char *end = strchr(path, ' ');
+        size_t length = end != nullptr ? static_cast<size_t>(end - path) : strlen(path);
+        return (length == 1 && path[0] == '/') || (length == 8 && strncmp(path, "/metrics", 8) == 0);
+    }
+
+    void writeResponse() {
+        if (!client.connected() || millis() - startedAt >= TIMEOUT_MS) {
+            close();
+            return;
+        }
+        while (client.availableForWrite() > 0) {
+            if (linePosition == lineLength) {
+                if (!nextLine()) {
+                    close();
+                    return;
+                }
+            }
+            size_t written = client.write(reinterpret_cast<const uint8_t *>(line + linePosition), lineLength - linePosition);
+            if (written == 0) return;
+            linePosition += written;
+        }
+    }
+
+    void close() {
+        client.stop();
+        buffer.unpin();
+        status = nullptr;
+        state = SERVER_IDLE;
+    }
+
+    /**
+     * Formats the next line of the response into line.
+     * @return false after the last one
+     */
+    bool nextLine() {
+        const size_t deviceCount = sizeof(DEVICE_METRICS) / sizeof(DEVICE_METRICS[0]);
+        const size_t floorCount = sizeof(FLOOR_METRICS) / sizeof(FLOOR_METRICS[0]);
+        const size_t roomCount = sizeof(ROOM_METRICS) / sizeof(ROOM_METRICS[0]);
+        const HeatingStatus &s = *status;
+        int length = -1;
+
+        while (length < 0) {
+            switch (family) {
+                case 0:
+                    length = snprintf(line, sizeof(line), found
+                                                          ? "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"
+                                                          : "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n");
+                    family = found ? 1 : 5;
+                    break;
+                case 1:
+                    if (item < deviceCount) {
+                        const StatusMetric &metric = DEVICE_METRICS[item++];
+                        uint32_t value;
+                        memcpy(&value, reinterpret_cast<const uint8_t *>(&s) + metric.offset, sizeof(value));
+                        length = snprintf(line, sizeof(line), "%s %lu\n", metric.name, static_cast<unsigned long>(value));
+                    } else {
+                        nextFamily();
+                    }
+                    break;
+                case 2:
+                    if (item < 2 * SENSOR_ROLES_COUNT) {
+                        byte role = item % SENSOR_ROLES_COUNT;
+                        bool stale = item++ >= SENSOR_ROLES_COUNT;
+                        if (stale) {
+                            length = snprintf(line, sizeof(line), "heating_sensor_stale{role=\"%s\"} %d\n",
+                                              SensorRegistry::ROLE_NAMES[role], s.dto.isStale(static_cast<SensorRole>(role)) ? 1 : 0);
+                        } else if (TemperatureSensors::isValidTemp(s.dto.temps[role])) {
+                            length = snprintf(line, sizeof(line), "heating_temperature_celsius{role=\"%s\"} %.2f\n",
+                                              SensorRegistry::ROLE_NAMES[role], s.dto.temps[role]);
+                        }
+                    } else {
+                        nextFamily();
+                    }
+                    break;
+                case 3:
+                    if (item < floorCount * FLOOR_ZONES_COUNT) {
+                        const StatusMetric &metric = FLOOR_METRICS[item / FLOOR_ZONES_COUNT];
+                        byte zone = item++ % FLOOR_ZONES_COUNT;
+                        length = formatZoneMetric(metric, FLOOR_ZONES[zone].name, &s.floors[zone]);
+                    } else {
+                        nextFamily();
+                    }
+                    break;
+                case 4:
+                    if (item < roomCount * RADIATOR_ZONES_COUNT) {
+                        const StatusMetric &metric = ROOM_METRICS[item / RADIATOR_ZONES_COUNT];
+                        byte zone = item++ % RADIATOR_ZONES_COUNT;
+                        if (metric.offset == offsetof(RadiatorZoneStatus, roomTemp) &&
+                            !TemperatureSensors::isValidTemp(s.rooms[zone].roomTemp)) {
+                            break;
+                        }
+                        length = formatZoneMetric(metric, RADIATOR_ZONES[zone].name, &s.rooms[zone]);
+                    } else {
+                        nextFamily();
+                    }
+                    break;
+                default:
+                    return false;
+            }
+        }
+        lineLength = static_cast<size_t>(length) < sizeof(line) ? length : sizeof(line) - 1;
+        linePosition = 0;
+        return true;
+    }
+
+    void nextFamily() {
+        family++;
+        item = 0;
+    }
+
+    int formatZoneMetric(const StatusMetric &metric, const char *zone, const void *zoneStatus) {
+        float value;
+        memcpy(&value, static_cast<const uint8_t *>(zoneStatus) + metric.offset, sizeof(value));
+        return snprintf(line, sizeof(line), "%s{zone=\"%s\"} %.2f\n", metric.name, zone, value);
+    }
+};
+
+#endif
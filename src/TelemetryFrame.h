@@ -0,0 +1,177 @@
+#ifndef SMARTHATA_HEATING_TELEMETRYFRAME_H
+#define SMARTHATA_HEATING_TELEMETRYFRAME_H
+
+#include "TelemetrySerializer.h"
+
+/**
+ * Compact binary form of Telemetry. A frame is
+ * - header: bits 0-3 VERSION, bit 7 set on a key frame
+ * - seq: uint8, one more than the previous frame on the topic
+ * - fields: 3 bytes little endian, bit i set when TelemetryField i follows
+ * - per set field in TelemetryField order: zigzag varint of the value in fixed point with the
+ *   field's TELEMETRY_FIELDS decimals, absolute on a key frame, the change since the previous
+ *   frame otherwise.
+ * A key frame carries every field of the topic, a delta frame only the fields that changed.
+ */
+namespace TelemetryFrame {
+    const byte VERSION = 1;
+    const byte KEY_FLAG = 0x80;
+    const byte HEADER_SIZE = 5;
+    const size_t MAX_SIZE = HEADER_SIZE + TELEMETRY_FIELDS_COUNT * 5;
+    const uint32_t ALL_FIELDS = (1UL << TELEMETRY_FIELDS_COUNT) - 1;
+
+    static_assert(TELEMETRY_FIELDS_COUNT <= 24, "TelemetryFrame field mask is 3 bytes");
+
+    // rounds like TelemetryWriter, so the decoded values print as the JSON would have
+    inline int32_t toFixed(float value, byte decimals) {
+        static const double SCALES[] = {1, 10, 100, 1000};
+        return static_cast<int32_t>(lround(value * SCALES[decimals < 3 ? decimals : 3]));
+    }
+
+    inline float fromFixed(int32_t value, byte decimals) {
+        static const float SCALES[] = {1, 10, 100, 1000};
+        return value / SCALES[decimals < 3 ? decimals : 3];
+    }
+}
+
+/**
+ * Encodes the telemetry of one topic, a key frame every KEY_FRAME_EVERY frames so a decoder
+ * that missed a frame recovers.
+ */
+class TelemetryFrameEncoder {
+public:
+    static const byte KEY_FRAME_EVERY = 20;
+
+private:
+    bool enabled = false;
+    int32_t last[TELEMETRY_FIELDS_COUNT]{};
+    uint8_t seq = 0;
+    byte sinceKey = KEY_FRAME_EVERY;
+
+public:
+
+    /**
+     * Starts with a key frame when switched on.
+     */
+    void setEnabled(bool on) {
+        if (on && !enabled) sinceKey = KEY_FRAME_EVERY;
+        enabled = on;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    /**
+     * @param fields mask of the TelemetryField values the topic carries
+     * @return frame length, out holds at least TelemetryFrame::MAX_SIZE bytes
+     */
+    size_t encode(const Telemetry &telemetry, uint32_t fields, uint8_t *out) {
+        bool key = sinceKey >= KEY_FRAME_EVERY;
+        sinceKey = key ? 1 : sinceKey + 1;
+
+        size_t length = TelemetryFrame::HEADER_SIZE;
+        uint32_t sent = 0;
+        for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+            if (!(fields & (1UL << i))) continue;
+            int32_t value = TelemetryFrame::toFixed(telemetry.values[i], TELEMETRY_FIELDS[i].decimals);
+            if (!key && value == last[i]) continue;
+            length += writeVarint(out + length, zigzag(key ? value : value - last[i]));
+            last[i] = value;
+            sent |= 1UL << i;
+        }
+
+        out[0] = TelemetryFrame::VERSION | (key ? TelemetryFrame::KEY_FLAG : 0);
+        out[1] = seq++;
+        out[2] = static_cast<uint8_t>(sent);
+        out[3] = static_cast<uint8_t>(sent >> 8);
+        out[4] = static_cast<uint8_t>(sent >> 16);
+        return length;
+    }
+
+private:
+
+    static uint32_t zigzag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    static byte writeVarint(uint8_t *out, uint32_t value) {
+        byte length = 0;
+        while (value > 0x7F) {
+            out[length++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        out[length++] = static_cast<uint8_t>(value);
+        return length;
+    }
+};
+
+/**
+ * Reference decoder of one topic's frames. Deltas after a lost frame are refused until
+ * the next key frame.
+ */
+class TelemetryFrameDecoder {
+private:
+    int32_t last[TELEMETRY_FIELDS_COUNT]{};
+    uint32_t known = 0;
+    bool synced = false;
+    uint8_t expectedSeq = 0;
+
+public:
+
+    /**
+     * @return false on a malformed frame or a delta without its base, telemetry is then unchanged
+     */
+    bool decode(const uint8_t *frame, size_t length, Telemetry &telemetry) {
+        if (length < TelemetryFrame::HEADER_SIZE || (frame[0] & 0x0F) != TelemetryFrame::VERSION) return false;
+        bool key = frame[0] & TelemetryFrame::KEY_FLAG;
+        if (!key && (!synced || frame[1] != expectedSeq)) {
+            synced = false;
+            return false;
+        }
+
+        uint32_t fields = frame[2] | static_cast<uint32_t>(frame[3]) << 8 | static_cast<uint32_t>(frame[4]) << 16;
+        if (fields & ~TelemetryFrame::ALL_FIELDS) return false;
+
+        int32_t values[TELEMETRY_FIELDS_COUNT];
+        memcpy(values, last, sizeof(values));
+        size_t position = TelemetryFrame::HEADER_SIZE;
+        for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+            if (!(fields & (1UL << i))) continue;
+            uint32_t raw = 0;
+            if (!readVarint(frame, length, position, raw)) return false;
+            int32_t value = static_cast<int32_t>(raw >> 1) ^ -static_cast<int32_t>(raw & 1);
+            values[i] = key ? value : values[i] + value;
+        }
+        if (position != length) return false;
+
+        memcpy(last, values, sizeof(last));
+        if (key) known = fields;
+        synced = true;
+        expectedSeq = frame[1] + 1;
+        for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+            telemetry.values[i] = TelemetryFrame::fromFixed(last[i], TELEMETRY_FIELDS[i].decimals);
+        }
+        return true;
+    }
+
+    /**
+     * @return mask of the fields the topic carries, from its last key frame
+     */
+    uint32_t getFields() const {
+        return known;
+    }
+
+private:
+
+    static bool readVarint(const uint8_t *frame, size_t length, size_t &position, uint32_t &value) {
+        for (byte shift = 0; shift < 35 && position < length; shift += 7) {
+            uint8_t b = frame[position++];
+            value |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+#endif
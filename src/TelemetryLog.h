@@ -0,0 +1,181 @@
+#ifndef SMARTHATA_HEATING_TELEMETRYLOG_H
+#define SMARTHATA_HEATING_TELEMETRYLOG_H
+
+#include <FS.h>
+#include <OneWire.h>
+#include "Log.h"
+
+struct TelemetryRecord {
+    uint32_t seq;
+    uint32_t uptimeSec;
+    uint16_t boot;
+    int16_t temps[6];
+    int16_t floorTempCorrected;
+    int16_t mixerValueDeciSec;
+    int16_t bedroomTemp;
+    int16_t bedroomTempExpected;
+    uint8_t mixerPositionAndPomp;
+    uint8_t crc;
+
+    static int16_t toCenti(float value) {
+        return static_cast<int16_t>(round(value * 100));
+    }
+};
+
+static_assert(sizeof(TelemetryRecord) == 32, "TelemetryRecord must stay 32 bytes");
+
+/**
+ * Fixed-record ring log on SPIFFS for telemetry that could not be published.
+ * Records are collected in RAM and written a whole flash page at a time,
+ * the read and write positions are kept in a small meta file.
+ */
+class TelemetryLog {
+public:
+    static const uint16_t SLOTS = 4096;
+    static const byte RECORDS_PER_PAGE = 8;
+    // replay progress is saved every META_EVERY batches, a reset re-sends at most those
+    static const byte META_EVERY = 16;
+
+private:
+    static constexpr const char *LOG_PATH = "/telemetry.log";
+    static constexpr const char *META_PATH = "/telemetry.meta";
+    static const uint32_t MAGIC = 0x534D4C31;
+
+    struct Meta {
+        uint32_t magic;
+        uint32_t head;
+        uint32_t replayed;
+        uint16_t boot;
+        uint8_t reserved;
+        uint8_t crc;
+    };
+
+    Meta meta{};
+    bool mounted = false;
+
+    TelemetryRecord page[RECORDS_PER_PAGE]{};
+    byte pageSize = 0;
+    byte unsavedMarks = 0;
+
+public:
+
+    void begin() {
+        mounted = SPIFFS.begin();
+        if (!mounted) {
+            LOG_ERROR(STORAGE, "TelemetryLog: SPIFFS mount failed");
+            return;
+        }
+        if (!readMeta()) {
+            meta = Meta();
+            meta.magic = MAGIC;
+            SPIFFS.remove(LOG_PATH);
+        }
+        meta.boot++;
+        writeMeta();
+        LOG_INFO(STORAGE, "TelemetryLog: backlog %lu", static_cast<unsigned long>(getBacklog()));
+    }
+
+    uint16_t getBoot() const {
+        return meta.boot;
+    }
+
+    uint32_t getBacklog() const {
+        return meta.head + pageSize - tail();
+    }
+
+    void append(TelemetryRecord &record) {
+        if (!mounted) return;
+        record.seq = meta.head + pageSize;
+        record.boot = meta.boot;
+        record.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&record), offsetof(TelemetryRecord, crc));
+        page[pageSize++] = record;
+        if (pageSize == RECORDS_PER_PAGE) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (!mounted || pageSize == 0) return;
+        File file = SPIFFS.open(LOG_PATH, SPIFFS.exists(LOG_PATH) ? "r+" : "w");
+        if (!file) return;
+
+        byte written = 0;
+        while (written < pageSize) {
+            uint16_t slot = (meta.head + written) % SLOTS;
+            byte chunk = pageSize - written;
+            if (slot + chunk > SLOTS) chunk = static_cast<byte>(SLOTS - slot);
+            file.seek(static_cast<uint32_t>(slot) * sizeof(TelemetryRecord), SeekSet);
+            file.write(reinterpret_cast<const uint8_t *>(&page[written]), chunk * sizeof(TelemetryRecord));
+            written += chunk;
+        }
+        file.close();
+
+        meta.head += pageSize;
+        pageSize = 0;
+        writeMeta();
+    }
+
+    /**
+     * Reads up to maxCount of the oldest not yet replayed records.
+     * Records with a bad checksum are skipped, a read finding only such records marks them replayed.
+     */
+    byte readBacklog(TelemetryRecord *records, byte maxCount) {
+        if (!mounted) return 0;
+        flush();
+        if (meta.replayed < tail()) meta.replayed = tail();
+
+        File file = SPIFFS.open(LOG_PATH, "r");
+        if (!file) return 0;
+
+        byte count = 0;
+        uint32_t seq = meta.replayed;
+        while (count < maxCount && seq < meta.head) {
+            TelemetryRecord &record = records[count];
+            file.seek(static_cast<uint32_t>(seq % SLOTS) * sizeof(TelemetryRecord), SeekSet);
+            bool valid = file.read(reinterpret_cast<uint8_t *>(&record), sizeof(TelemetryRecord)) == sizeof(TelemetryRecord)
+                         && record.seq == seq
+                         && record.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&record), offsetof(TelemetryRecord, crc));
+            if (valid) count++;
+            seq++;
+        }
+        file.close();
+        if (count == 0 && seq != meta.replayed) advanceReplayed(seq);
+        return count;
+    }
+
+    void markReplayed(const TelemetryRecord &last) {
+        advanceReplayed(last.seq + 1);
+    }
+
+private:
+
+    void advanceReplayed(uint32_t seq) {
+        meta.replayed = seq;
+        if (++unsavedMarks >= META_EVERY || meta.replayed >= meta.head) writeMeta();
+    }
+
+    uint32_t tail() const {
+        return meta.head > SLOTS ? max(meta.replayed, meta.head - SLOTS) : meta.replayed;
+    }
+
+    bool readMeta() {
+        File file = SPIFFS.open(META_PATH, "r");
+        if (!file) return false;
+        bool valid = file.read(reinterpret_cast<uint8_t *>(&meta), sizeof(Meta)) == sizeof(Meta)
+                     && meta.magic == MAGIC
+                     && meta.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&meta), offsetof(Meta, crc));
+        file.close();
+        return valid;
+    }
+
+    void writeMeta() {
+        unsavedMarks = 0;
+        meta.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&meta), offsetof(Meta, crc));
+        File file = SPIFFS.open(META_PATH, "w");
+        if (!file) return;
+        file.write(reinterpret_cast<const uint8_t *>(&meta), sizeof(Meta));
+        file.close();
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef SMARTHATA_HEATING_TELEMETRYSERIALIZER_H
+#define SMARTHATA_HEATING_TELEMETRYSERIALIZER_H
+
+#include "TemperatureSensors.h"
+#include "TelemetryLog.h"
+
+enum TelemetryField : byte {
+    FLOOR,
+    FLOOR_CORRECTED,
+    MIXER_POSITION,
+    MIXER_VALUE_SEC,
+    MIXER_TRAVEL,
+    MIXED_SETPOINT,
+    MQTT_ATTEMPTS,
+    MQTT_UPTIME,
+    UPTIME,
+    MIXED,
+    COLD,
+    HOT,
+    STREET,
+    BATTERY,
+    BOILER,
+    BEDROOM,
+    BEDROOM_EXPECTED,
+    BATTERY_POMP,
+    STALE_SENSORS,
+    TELEMETRY_FIELDS_COUNT
+};
+
+enum TelemetrySink : byte {
+    MQTT_JSON,
+    SMARTHATA_QUERY,
+    NARODMON_QUERY,
+    TELEMETRY_SINKS_COUNT
+};
+
+enum TelemetryFormat : byte {
+    PLAIN_VALUE,
+    // left out of the JSON while the sensor reading is invalid
+    TEMPERATURE_VALUE,
+    // seconds, written in JSON as the largest whole unit, "days", "hours", "mins" or "sec"
+    UPTIME_UNITS
+};
+
+struct TelemetryFieldInfo {
+    const char *keys[TELEMETRY_SINKS_COUNT];
+    byte decimals;
+    TelemetryFormat format;
+};
+
+constexpr TelemetryFieldInfo TELEMETRY_FIELDS[] = {
+        {{nullptr,                 "floor",                 nullptr},     1, PLAIN_VALUE},
+        {{"floor-corrected",       "corrected",             "corrected"}, 2, PLAIN_VALUE},
+        {{"mixer-position",        "mixer-position",        nullptr},     0, PLAIN_VALUE},
+        {{"mixer-pid-value-sec",   "mixer-pid-value-sec",   nullptr},     1, PLAIN_VALUE},
+        {{"mixer-travel",          nullptr,                 nullptr},     0, PLAIN_VALUE},
+        {{"mixed-setpoint",        nullptr,                 nullptr},     1, PLAIN_VALUE},
+        {{"mqtt-attempts",         nullptr,                 nullptr},     0, PLAIN_VALUE},
+        {{"mqtt-uptime",           nullptr,                 nullptr},     0, PLAIN_VALUE},
+        {{"uptime",                nullptr,                 nullptr},     0, UPTIME_UNITS},
+        {{"mixed",                 "mixed",                 "mixed"},     2, TEMPERATURE_VALUE},
+        {{"cold",                  "cold",                  nullptr},     2, TEMPERATURE_VALUE},
+        {{"hot",                   "heating",               nullptr},     2, TEMPERATURE_VALUE},
+        {{"street",                "street",                "street"},    2, TEMPERATURE_VALUE},
+        {{"battery",               "battery",               nullptr},     2, TEMPERATURE_VALUE},
+        {{"boiler",                "boiler",                nullptr},     2, TEMPERATURE_VALUE},
+        {{"bedroom-temp",          nullptr,                 nullptr},     2, TEMPERATURE_VALUE},
+        {{"bedroom-temp-expected", "bedroom-temp-expected", nullptr},     1, PLAIN_VALUE},
+        {{"battery-pomp",          "battery-pomp",          nullptr},     0, PLAIN_VALUE},
+        {{"stale-sensors",         nullptr,                 nullptr},     0, PLAIN_VALUE},
+};
+
+static_assert(sizeof(TELEMETRY_FIELDS) / sizeof(TELEMETRY_FIELDS[0]) == TELEMETRY_FIELDS_COUNT,
+              "TELEMETRY_FIELDS must describe every TelemetryField");
+
+struct Telemetry {
+    float values[TELEMETRY_FIELDS_COUNT]{};
+
+    float &operator[](TelemetryField field) {
+        return values[field];
+    }
+
+    float operator[](TelemetryField field) const {
+        return values[field];
+    }
+};
+
+/**
+ * Appends to a caller-owned buffer, truncating and keeping it NUL-terminated on overflow.
+ */
+class TelemetryWriter {
+private:
+    char *buffer;
+    size_t capacity;
+    size_t length = 0;
+
+public:
+    TelemetryWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+        if (capacity > 0) buffer[0] = '\0';
+    }
+
+    TelemetryWriter &append(char c) {
+        if (length + 1 < capacity) {
+            buffer[length++] = c;
+            buffer[length] = '\0';
+        }
+        return *this;
+    }
+
+    TelemetryWriter &append(const char *str) {
+        while (*str) append(*str++);
+        return *this;
+    }
+
+    TelemetryWriter &append(unsigned long number) {
+        char digits[10];
+        byte count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + number % 10);
+            number /= 10;
+        } while (number > 0);
+        while (count > 0) append(digits[--count]);
+        return *this;
+    }
+
+    TelemetryWriter &append(float value, byte decimals) {
+        static const unsigned long SCALES[] = {1, 10, 100, 1000};
+        const unsigned long scale = SCALES[decimals < 3 ? decimals : 3];
+        double scaled = value * (double) scale;
+        if (scaled < 0) {
+            append('-');
+            scaled = -scaled;
+        }
+        unsigned long fixed = static_cast<unsigned long>(scaled + 0.5);
+        append(fixed / scale);
+        if (decimals > 0) {
+            append('.');
+            for (unsigned long divider = scale / 10; divider > 0; divider /= 10) {
+                append(static_cast<char>('0' + fixed / divider % 10));
+            }
+        }
+        return *this;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+/**
+ * Writes one Telemetry snapshot in every sink format, single pass over the field schema.
+ */
+class TelemetrySerializer {
+public:
+
+    static size_t toJson(const Telemetry &telemetry, char *buffer, size_t size) {
+        TelemetryWriter writer = TelemetryWriter(buffer, size);
+        writer.append('{');
+        bool first = true;
+        for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+            const TelemetryField field = static_cast<TelemetryField>(i);
+            const char *key = TELEMETRY_FIELDS[i].keys[MQTT_JSON];
+            if (key == nullptr || isSkipped(telemetry, field)) continue;
+            if (!first) writer.append(',');
+            first = false;
+            if (TELEMETRY_FIELDS[i].format == UPTIME_UNITS) {
+                appendUptime(writer, static_cast<unsigned long>(telemetry[field]));
+            } else {
+                writer.append('"').append(key).append("\":");
+                writer.append(telemetry[field], TELEMETRY_FIELDS[i].decimals);
+            }
+        }
+        writer.append('}');
+        return writer.size();
+    }
+
+    static size_t toQuery(const Telemetry &telemetry, TelemetrySink sink, char *buffer, size_t size) {
+        TelemetryWriter writer = TelemetryWriter(buffer, size);
+        bool first = true;
+        for (byte i = 0; i < TELEMETRY_FIELDS_COUNT; ++i) {
+            const char *key = TELEMETRY_FIELDS[i].keys[sink];
+            if (key == nullptr) continue;
+            if (!first) writer.append('&');
+            first = false;
+            writer.append(key).append('=').append(telemetry.values[i], TELEMETRY_FIELDS[i].decimals);
+        }
+        return writer.size();
+    }
+
+    static void toRecord(const Telemetry &telemetry, TelemetryRecord &record) {
+        record.uptimeSec = static_cast<uint32_t>(telemetry[UPTIME]);
+        record.temps[0] = TelemetryRecord::toCenti(telemetry[MIXED]);
+        record.temps[1] = TelemetryRecord::toCenti(telemetry[COLD]);
+        record.temps[2] = TelemetryRecord::toCenti(telemetry[HOT]);
+        record.temps[3] = TelemetryRecord::toCenti(telemetry[BATTERY]);
+        record.temps[4] = TelemetryRecord::toCenti(telemetry[BOILER]);
+        record.temps[5] = TelemetryRecord::toCenti(telemetry[STREET]);
+        record.floorTempCorrected = TelemetryRecord::toCenti(telemetry[FLOOR_CORRECTED]);
+        record.mixerValueDeciSec = static_cast<int16_t>(round(telemetry[MIXER_VALUE_SEC] * 10));
+        record.bedroomTemp = TelemetryRecord::toCenti(telemetry[BEDROOM]);
+        record.bedroomTempExpected = TelemetryRecord::toCenti(telemetry[BEDROOM_EXPECTED]);
+        unsigned int position = static_cast<unsigned int>(telemetry[MIXER_POSITION]);
+        record.mixerPositionAndPomp = static_cast<uint8_t>((position < 0x7F ? position : 0x7F) |
+                                                           (telemetry[BATTERY_POMP] > 0 ? 0x80 : 0));
+    }
+
+private:
+
+    static bool isSkipped(const Telemetry &telemetry, TelemetryField field) {
+        return TELEMETRY_FIELDS[field].format == TEMPERATURE_VALUE && !TemperatureSensors::isValidTemp(telemetry[field]);
+    }
+
+    static void appendUptime(TelemetryWriter &writer, unsigned long sec) {
+        unsigned long mins = sec / 60;
+        unsigned long hours = mins / 60;
+        unsigned long days = hours / 24;
+        if (days > 0) {
+            writer.append("\"days\":").append(days);
+        } else if (hours > 0) {
+            writer.append("\"hours\":").append(hours % 24);
+        } else if (mins > 0) {
+            writer.append("\"mins\":").append(mins % 60);
+        } else {
+            writer.append("\"sec\":").append(sec % 60);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef SMARTHATA_HEATING_TELEMETRYUPLOADER_H
+#define SMARTHATA_HEATING_TELEMETRYUPLOADER_H
+
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WiFi.h>
+#include <Timeout.h>
+#include "Log.h"
+
+struct UploadEndpoint {
+    const char *name;
+    bool post;
+    uint16_t timeoutMs;
+    unsigned long minIntervalMs;
+    byte maxAttempts;
+    unsigned long retryDelayMs;
+};
+
+/**
+ * Queue of pending HTTP requests. The control loop only enqueues,
+ * loop() sends at most one request per call within the endpoint's timeout.
+ * A newer request for an endpoint replaces the one still waiting in the queue.
+ * Rate limits and retry backoff are per endpoint, a held back endpoint does not block the others.
+ */
+class TelemetryUploader {
+public:
+    static const byte QUEUE_SIZE = 4;
+    static const byte ENDPOINTS_MAX = 4;
+    static const unsigned int URL_SIZE = 256;
+
+private:
+    struct Request {
+        byte endpoint;
+        byte attempts;
+        char url[URL_SIZE];
+    };
+
+    HTTPClient http;
+
+    const UploadEndpoint *endpoints;
+    const byte endpointsCount;
+
+    Request queue[QUEUE_SIZE]{};
+    byte head = 0;
+    byte size = 0;
+
+    Timeout retryTimeouts[ENDPOINTS_MAX];
+    unsigned long lastSent[ENDPOINTS_MAX]{};
+
+    unsigned long sent = 0;
+    unsigned long failed = 0;
+    unsigned long dropped = 0;
+
+public:
+    TelemetryUploader(const UploadEndpoint *endpoints, byte endpointsCount) :
+            endpoints(endpoints), endpointsCount(endpointsCount < ENDPOINTS_MAX ? endpointsCount : ENDPOINTS_MAX) {
+        for (byte i = 0; i < this->endpointsCount; ++i) {
+            lastSent[i] = millis() - endpoints[i].minIntervalMs;
+            retryTimeouts[i].start(0);
+        }
+    }
+
+    bool enqueue(byte endpoint, const char *url) {
+        if (endpoint >= endpointsCount) return false;
+
+        Request *request = findWaiting(endpoint);
+        if (request == nullptr) {
+            if (size == QUEUE_SIZE) {
+                dropped++;
+                return false;
+            }
+            request = &queue[(head + size++) % QUEUE_SIZE];
+        }
+        request->endpoint = endpoint;
+        request->attempts = 0;
+        strncpy(request->url, url, URL_SIZE - 1);
+        request->url[URL_SIZE - 1] = '\0';
+        return true;
+    }
+
+    /**
+     * Sends the oldest request whose endpoint is neither rate limited nor backing off.
+     */
+    void loop() {
+        if (size == 0 || !WiFi.isConnected()) return;
+
+        byte index = 0;
+        while (index < size && !isReady(queue[(head + index) % QUEUE_SIZE].endpoint)) index++;
+        if (index == size) return;
+
+        Request &request = queue[(head + index) % QUEUE_SIZE];
+        const UploadEndpoint &endpoint = endpoints[request.endpoint];
+        lastSent[request.endpoint] = millis();
+        int code = send(request, endpoint);
+        if (code > 0) {
+            sent++;
+            remove(index);
+        } else {
+            failed++;
+            LOG_WARN(UPLOAD, "HTTP request to %s failed: %d", endpoint.name, code);
+            if (++request.attempts >= endpoint.maxAttempts) {
+                dropped++;
+                remove(index);
+            } else {
+                retryTimeouts[request.endpoint].start(endpoint.retryDelayMs * request.attempts);
+            }
+        }
+    }
+
+    byte getQueueSize() const {
+        return size;
+    }
+
+    unsigned long getSent() const {
+        return sent;
+    }
+
+    unsigned long getFailed() const {
+        return failed;
+    }
+
+    unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+
+    Request *findWaiting(byte endpoint) {
+        for (byte i = 0; i < size; ++i) {
+            Request &request = queue[(head + i) % QUEUE_SIZE];
+            if (request.endpoint == endpoint && request.attempts == 0) return &request;
+        }
+        return nullptr;
+    }
+
+    int send(const Request &request, const UploadEndpoint &endpoint) {
+        http.setTimeout(endpoint.timeoutMs);
+        http.begin(request.url);
+        int code = endpoint.post ? http.POST("") : http.GET();
+        http.end();
+        return code;
+    }
+
+    bool isReady(byte endpoint) {
+        return millis() - lastSent[endpoint] >= endpoints[endpoint].minIntervalMs && retryTimeouts[endpoint].isReady();
+    }
+
+    void remove(byte index) {
+        for (byte i = index; i + 1 < size; ++i) {
+            queue[(head + i) % QUEUE_SIZE] = queue[(head + i + 1) % QUEUE_SIZE];
+        }
+        size--;
+    }
+};
+
+#endif
@@ -2,57 +2,129 @@
 #define SMARTHATA_HEATING_TEMPERATURESENSORS_H
 
 #include <DallasTemperature.h>
-#include <Stopwatch.h>
-
+#include <Interval.h>
+#include <Timeout.h>
+#include "SensorRegistry.h"
+#include "SensorFilters.h"
+#include "InputRecorder.h"
+#include "Log.h"
+
+/**
+ * Filtered temperatures in SensorRole order. A stale value, one without an accepted sample
+ * within its role's limit, reads as DEVICE_DISCONNECTED_C and has its bit set in staleMask.
+ */
 struct SmartHeatingDto {
-    float floorMixedTemp = DEVICE_DISCONNECTED_C;
-    float floorColdTemp = DEVICE_DISCONNECTED_C;
-    float heatingHotTemp = DEVICE_DISCONNECTED_C;
-    float batteryColdTemp = DEVICE_DISCONNECTED_C;
-    float boilerTemp = DEVICE_DISCONNECTED_C;
-    float streetTemp = DEVICE_DISCONNECTED_C;
+    float temps[SENSOR_ROLES_COUNT];
+
+    unsigned long updatedAt[SENSOR_ROLES_COUNT]{};
+    uint16_t staleMask = (1 << SENSOR_ROLES_COUNT) - 1;
+
+    SmartHeatingDto() {
+        for (float &temp : temps) temp = DEVICE_DISCONNECTED_C;
+    }
+
+    float temp(SensorRole role) const {
+        return temps[role];
+    }
+
+    bool isStale(SensorRole role) const {
+        return staleMask & (1 << role);
+    }
 } th;
 
+static_assert(SENSOR_ROLES_COUNT <= 16, "staleMask holds 16 roles");
+
 class TemperatureSensors {
 private:
     static const int DALLAS_RESOLUTION = 12;
+    static const byte SENSORS_COUNT = SENSOR_ROLES_COUNT;
+    static const byte MAX_READ_ATTEMPTS = 3;
+
+    enum State {
+        IDLE, CONVERTING, READING
+    };
 
     OneWire oneWire = OneWire(DALLAS_PIN);
     DallasTemperature dallasTemperature = DallasTemperature(&oneWire);
 
-    DeviceAddress mixedWaterAddress = {0x28, 0x61, 0xBF, 0x3A, 0x06, 0x00, 0x00, 0x48};
-    DeviceAddress coldWaterAddress = {0x28, 0x55, 0x8A, 0xCC, 0x06, 0x00, 0x00, 0x57};
-    DeviceAddress hotWaterAddress = {0x28, 0x6F, 0xE8, 0xCA, 0x06, 0x00, 0x00, 0xEE};
-    DeviceAddress batteryColdAddress = {0x28, 0xC2, 0x6E, 0xCB, 0x06, 0x00, 0x00, 0x20};
-    DeviceAddress boilerAddress = {0x28, 0xD4, 0xD3, 0xE1, 0x06, 0x00, 0x00, 0x01};
-    DeviceAddress streetAddress = {0x28, 0xFF, 0x98, 0x3A, 0x91, 0x16, 0x04, 0x36};
+    SensorRegistry registry;
+    Interval scanInterval = Interval(300000);
+    bool scanning = false;
+
+    Interval blinkInterval = Interval(300);
+    byte blinks = 0;
+    bool devicesReported = false;
+
+    SensorFilter filters[SENSORS_COUNT] = {
+            SensorFilter({1.0f, 0.5f, 1.0f, 30000}),    // mixed, feeds the inner loop unsmoothed
+            SensorFilter({0.5f, 0.5f, 0.5f, 60000}),    // cold
+            SensorFilter({1.0f, 0.5f, 1.0f, 30000}),    // hot
+            SensorFilter({0.5f, 0.5f, 0.5f, 60000}),    // battery
+            SensorFilter({1.0f, 0.5f, 1.0f, 30000}),    // boiler
+            SensorFilter({0.05f, 1.0f, 0.2f, 600000}),  // street
+    };
+
+    State state = IDLE;
+    Timeout conversionTimeout = Timeout();
+    unsigned int conversionTime = 750;
+    byte nextSensor = 0;
+    byte attempts[SENSORS_COUNT]{};
+    bool pending[SENSORS_COUNT]{};
 
 public:
     TemperatureSensors() {
+        registry.begin();
         dallasTemperature.begin();
         dallasTemperature.setResolution(DALLAS_RESOLUTION);
-        printDevices();
+        dallasTemperature.setWaitForConversion(false);
+        conversionTime = static_cast<unsigned int>(dallasTemperature.millisToWaitForConversion(DALLAS_RESOLUTION));
+        scanInterval.startWithCurrentTimeEnabled();
+        blinkInterval.startWithCurrentTime();
     }
 
-    SmartHeatingDto updateTemperatures() {
+    bool assign(SensorRole role, const uint8_t *rom) {
+        return registry.assign(role, rom);
+    }
+
+    /**
+     * Starts conversion on all sensors and returns immediately.
+     * Ignored while the previous cycle is still in progress.
+     */
+    bool startConversion() {
+        if (state != IDLE) return false;
+
+        for (byte i = 0; i < SENSORS_COUNT; ++i) {
+            pending[i] = true;
+            attempts[i] = 0;
+        }
         dallasTemperature.requestTemperatures();
+        conversionTimeout.start(conversionTime);
+        state = CONVERTING;
+        return true;
+    }
 
-        th.floorMixedTemp = safeReadTemp(mixedWaterAddress, th.floorMixedTemp);
-        th.floorColdTemp = safeReadTemp(coldWaterAddress, th.floorColdTemp);
-        th.heatingHotTemp = safeReadTemp(hotWaterAddress, th.heatingHotTemp);
-        th.batteryColdTemp = safeReadTemp(batteryColdAddress, th.batteryColdTemp);
-        th.boilerTemp = safeReadTemp(boilerAddress, th.boilerTemp);
-        th.streetTemp = safeReadTemp(streetAddress,th.streetTemp);
-
-        Serial.print("Read temperatures: ");
-        printValue("floorMixedTemp", th.floorMixedTemp);
-        printValue("floorColdTemp", th.floorColdTemp);
-        printValue("heatingHotTemp", th.heatingHotTemp);
-        printValue("batteryColdTemp", th.batteryColdTemp);
-        printValue("boilerTemp", th.boilerTemp);
-        printValue("streetTemp", th.streetTemp);
-        Serial.println();
+    /**
+     * Advances the conversion cycle by at most one bus operation per call.
+     * @return true when a complete set of fresh temperatures is ready
+     */
+    bool loop() {
+        blink();
+        switch (state) {
+            case CONVERTING:
+                if (conversionTimeout.isReady()) {
+                    nextSensor = 0;
+                    state = READING;
+                }
+                return false;
+            case READING:
+                return readNextSensor();
+            default:
+                scan();
+                return false;
+        }
+    }
 
+    const SmartHeatingDto &getTemperatures() const {
         return th;
     }
 
@@ -66,55 +138,94 @@ private:
         return tempC == DEVICE_DISCONNECTED_C;
     }
 
-    void printValue(const char *name, float value) const {
-        Serial.print(String(name) + " = " + value + " \t");
+    bool readNextSensor() {
+        while (nextSensor < SENSORS_COUNT && !pending[nextSensor]) {
+            nextSensor++;
+        }
+
+        if (nextSensor < SENSORS_COUNT) {
+            readSensor(nextSensor++);
+            return false;
+        }
+
+        if (retryPendingSensors()) {
+            return false;
+        }
+
+        state = IDLE;
+        updateValues();
+        printTemperatures();
+        return true;
     }
 
-    float safeReadTemp(DeviceAddress &address, float prevTemp = DEVICE_DISCONNECTED_C) {
-        float tempC = dallasTemperature.getTempC(address);
-        Stopwatch stopwatch;
-        while (!isValidTemp(tempC) && stopwatch.isLessThan(1000)) {
-            delay(20);
-            dallasTemperature.requestTemperaturesByAddress(address);
-            tempC = dallasTemperature.getTempC(address);
+    /**
+     * A valid read ends the sensor's cycle even if the filter rejects it, only failed reads are retried.
+     */
+    void readSensor(byte i) {
+        float tempC = dallasTemperature.getTempC(registry.address(static_cast<SensorRole>(i)));
+        inputRecorder.sensor(i, tempC);
+        if (isValidTemp(tempC)) {
+            filters[i].add(tempC, millis());
+            pending[i] = false;
+        } else if (++attempts[i] >= MAX_READ_ATTEMPTS) {
+            pending[i] = false;
         }
-        return isValidTemp(tempC) ? tempC : prevTemp;
     }
 
-    void printDevices() {
-        byte deviceCount = dallasTemperature.getDeviceCount();
-        Serial.print("DallasTemperature deviceCount = ");
-        Serial.println(deviceCount);
+    void updateValues() {
+        unsigned long now = millis();
+        th.staleMask = 0;
+        for (byte i = 0; i < SENSORS_COUNT; ++i) {
+            th.updatedAt[i] = filters[i].getUpdatedAt();
+            if (filters[i].isStale(now)) {
+                th.temps[i] = DEVICE_DISCONNECTED_C;
+                th.staleMask |= 1 << i;
+            } else {
+                th.temps[i] = filters[i].get();
+            }
+        }
+    }
 
-        for (int i = 0; i < deviceCount; ++i) {
-            blink(300);
+    bool retryPendingSensors() {
+        bool retry = false;
+        for (byte i = 0; i < SENSORS_COUNT; ++i) {
+            if (pending[i]) {
+                dallasTemperature.requestTemperaturesByAddress(registry.address(static_cast<SensorRole>(i)));
+                retry = true;
+            }
         }
-        Serial.println();
+        if (retry) {
+            conversionTimeout.start(conversionTime);
+            state = CONVERTING;
+        }
+        return retry;
+    }
 
-        oneWire.reset_search();
-        DeviceAddress tempAddress;
-        while (oneWire.search(tempAddress)) {
-            printAddress(tempAddress);
+    void printTemperatures() const {
+        if (!LOG_ENABLED(LOG_LEVEL_DEBUG, SENSORS)) return;
+        char line[160]{};
+        size_t length = 0;
+        for (byte i = 0; i < SENSORS_COUNT && length < sizeof(line); ++i) {
+            length += snprintf(line + length, sizeof(line) - length, " %s = %.2f",
+                               SensorRegistry::ROLE_NAMES[i], th.temps[i]);
         }
+        LOG_DEBUG(SENSORS, "Read temperatures:%s", line);
     }
 
-    void printAddress(DeviceAddress deviceAddress) {
-        Serial.print("{");
-        for (byte i = 0; i < 8; i++) {
-            Serial.print("0x");
-            if (deviceAddress[i] < 16) Serial.print("0");
-            Serial.print(deviceAddress[i], HEX);
-            Serial.print(", ");
+    void scan() {
+        if (!scanning && !scanInterval.isReady()) return;
+        scanning = !registry.scanStep(oneWire);
+        if (!scanning && !devicesReported) {
+            devicesReported = true;
+            LOG_INFO(SENSORS, "DallasTemperature deviceCount = %u", registry.getFoundCount());
+            blinks = registry.getFoundCount() * 2;
         }
-        Serial.println("}");
     }
 
-    void blink(unsigned int delayMs = 300) const {
-        Serial.print(".");
-        digitalWrite(LED_BUILTIN, HIGH);
-        delay(delayMs);
-        digitalWrite(LED_BUILTIN, LOW);
-        delay(delayMs);
+    void blink() {
+        if (blinks > 0 && blinkInterval.isReady()) {
+            digitalWrite(LED_BUILTIN, blinks-- % 2 == 0 ? HIGH : LOW);
+        }
     }
 };
 
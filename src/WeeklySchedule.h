@@ -0,0 +1,257 @@
+#ifndef SMARTHATA_HEATING_WEEKLYSCHEDULE_H
+#define SMARTHATA_HEATING_WEEKLYSCHEDULE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <OneWire.h>
+#include "LocalClock.h"
+#include "Log.h"
+
+enum ScheduleChannel : byte {
+    SCHEDULE_FLOOR, SCHEDULE_BEDROOM, SCHEDULE_CHANNELS_COUNT
+};
+
+/**
+ * Weekly temperature corrections with minute resolution. The schedule is set as one blob of
+ * channels separated by ';', each one a channel name followed by "[days@]HHMM=value" entries,
+ * e.g. "floor 0000=-3 0600=0;bedroom 0500=1 0700=3 12345@0800=1 2300=2". Days are digits,
+ * 1 is Monday, entries without days apply every day. The blob is expanded into sorted
+ * transition times per channel, and the current value is cached until the next transition.
+ */
+class WeeklySchedule {
+public:
+
+    static const byte TRANSITIONS_MAX = 48;
+    static const size_t BLOB_SIZE = 192;
+
+    static constexpr const char *CHANNEL_NAMES[] = {"floor", "bedroom"};
+    static_assert(sizeof(CHANNEL_NAMES) / sizeof(CHANNEL_NAMES[0]) == SCHEDULE_CHANNELS_COUNT,
+                  "every ScheduleChannel needs a name");
+
+private:
+
+    static constexpr const char *PATH = "/schedule.bin";
+    static const uint32_t MAGIC = 0x57534331;
+    static constexpr const char *DEFAULT_BLOB =
+            "floor 0000=-3 0200=-2 0500=-1 0600=0;bedroom 0000=0 0500=1 0600=2 0700=3 2300=2";
+
+    struct Transition {
+        uint16_t minute;
+        int16_t valueCenti;
+    };
+
+    struct Channel {
+        Transition transitions[TRANSITIONS_MAX];
+        byte count;
+
+        int from;
+        int until;
+        int16_t current;
+    };
+
+    struct Stored {
+        uint32_t magic;
+        char blob[BLOB_SIZE];
+        uint8_t crc;
+    };
+
+    Channel channels[SCHEDULE_CHANNELS_COUNT]{};
+    char blob[BLOB_SIZE]{};
+
+public:
+
+    void begin() {
+        if (!SPIFFS.begin() || !load() || !compile(blob, channels)) {
+            LOG_INFO(HEATING, "WeeklySchedule: using built-in schedule");
+            strncpy(blob, DEFAULT_BLOB, sizeof(blob) - 1);
+            compile(blob, channels);
+        }
+    }
+
+    /**
+     * @return correction at the current local time, 0 while the clock is not synced
+     */
+    float value(ScheduleChannel channel) {
+        return value(channel, localClock.minuteOfWeek());
+    }
+
+    float value(ScheduleChannel channel, int minuteOfWeek) {
+        Channel &c = channels[channel];
+        if (minuteOfWeek < 0 || c.count == 0) return 0;
+        if (minuteOfWeek < c.from || minuteOfWeek >= c.until) locate(c, minuteOfWeek);
+        return c.current * 0.01f;
+    }
+
+    /**
+     * Looks up the next transition of the channel.
+     * @return minutes until it, -1 while the clock is not synced or the channel is empty
+     */
+    int minutesToNext(ScheduleChannel channel, float &nextValue) {
+        int minute = localClock.minuteOfWeek();
+        Channel &c = channels[channel];
+        if (minute < 0 || c.count == 0) return -1;
+        value(channel, minute);
+
+        int next = c.until;
+        int minutes = next - minute;
+        if (next >= static_cast<int>(LocalClock::MINUTES_PER_WEEK)) {
+            next = c.transitions[0].minute;
+            minutes = LocalClock::MINUTES_PER_WEEK - minute + next;
+        }
+        for (byte i = 0; i < c.count; ++i) {
+            if (c.transitions[i].minute == next) nextValue = c.transitions[i].valueCenti * 0.01f;
+        }
+        return minutes;
+    }
+
+    /**
+     * @return false when the blob is malformed, the schedule is unchanged then
+     */
+    bool configure(const char *payload) {
+        if (strlen(payload) >= BLOB_SIZE) return false;
+        Channel parsed[SCHEDULE_CHANNELS_COUNT]{};
+        if (!compile(payload, parsed)) return false;
+
+        memcpy(channels, parsed, sizeof(channels));
+        memcpy(blob, payload, strlen(payload) + 1);
+        save();
+        return true;
+    }
+
+    const char *getBlob() const {
+        return blob;
+    }
+
+private:
+
+    static void locate(Channel &c, int minute) {
+        byte next = 0;
+        while (next < c.count && c.transitions[next].minute <= minute) next++;
+
+        if (next == 0) {
+            c.from = 0;
+            c.current = c.transitions[c.count - 1].valueCenti;
+        } else {
+            c.from = c.transitions[next - 1].minute;
+            c.current = c.transitions[next - 1].valueCenti;
+        }
+        c.until = next < c.count ? c.transitions[next].minute : LocalClock::MINUTES_PER_WEEK;
+    }
+
+    static bool compile(const char *text, Channel *out) {
+        for (byte i = 0; i < SCHEDULE_CHANNELS_COUNT; ++i) {
+            out[i].count = 0;
+            out[i].from = out[i].until = 0;
+        }
+
+        const char *p = text;
+        while (*p) {
+            while (*p == ' ' || *p == ';') p++;
+            if (*p == '\0') break;
+
+            const char *nameEnd = p;
+            while (*nameEnd && *nameEnd != ' ' && *nameEnd != ';') nameEnd++;
+            int channel = findChannel(p, static_cast<size_t>(nameEnd - p));
+            if (channel < 0) return false;
+            p = nameEnd;
+
+            while (*p && *p != ';') {
+                while (*p == ' ') p++;
+                if (*p == '\0' || *p == ';') break;
+                p = parseEntry(p, out[channel]);
+                if (p == nullptr) return false;
+            }
+        }
+
+        for (byte i = 0; i < SCHEDULE_CHANNELS_COUNT; ++i) {
+            sort(out[i]);
+        }
+        return true;
+    }
+
+    /**
+     * @return position after the entry, nullptr when malformed or the channel is full
+     */
+    static const char *parseEntry(const char *p, Channel &channel) {
+        byte days = 0x7F;
+        const char *at = p;
+        while (*at >= '0' && *at <= '9') at++;
+        if (*at == '@') {
+            days = 0;
+            for (const char *d = p; d < at; ++d) {
+                if (*d < '1' || *d > '7') return nullptr;
+                days |= 1 << (*d - '1');
+            }
+            p = at + 1;
+        }
+
+        if (!isdigit(p[0]) || !isdigit(p[1]) || !isdigit(p[2]) || !isdigit(p[3]) || p[4] != '=') return nullptr;
+        int hour = (p[0] - '0') * 10 + (p[1] - '0');
+        int minute = (p[2] - '0') * 10 + (p[3] - '0');
+        if (hour > 23 || minute > 59) return nullptr;
+
+        char *end;
+        float value = strtof(p + 5, &end);
+        if (end == p + 5 || value < -30 || value > 30) return nullptr;
+
+        for (byte day = 0; day < 7; ++day) {
+            if (!(days & (1 << day))) continue;
+            if (channel.count >= TRANSITIONS_MAX) return nullptr;
+            Transition &t = channel.transitions[channel.count++];
+            t.minute = static_cast<uint16_t>(day * 1440 + hour * 60 + minute);
+            t.valueCenti = static_cast<int16_t>(lroundf(value * 100));
+        }
+        return end;
+    }
+
+    static void sort(Channel &c) {
+        for (byte i = 1; i < c.count; ++i) {
+            Transition t = c.transitions[i];
+            byte j = i;
+            while (j > 0 && c.transitions[j - 1].minute > t.minute) {
+                c.transitions[j] = c.transitions[j - 1];
+                j--;
+            }
+            c.transitions[j] = t;
+        }
+    }
+
+    static int findChannel(const char *name, size_t length) {
+        for (byte i = 0; i < SCHEDULE_CHANNELS_COUNT; ++i) {
+            if (strlen(CHANNEL_NAMES[i]) == length && strncmp(CHANNEL_NAMES[i], name, length) == 0) return i;
+        }
+        return -1;
+    }
+
+    bool load() {
+        File file = SPIFFS.open(PATH, "r");
+        if (!file) return false;
+        Stored stored{};
+        bool valid = file.read(reinterpret_cast<uint8_t *>(&stored), sizeof(Stored)) == sizeof(Stored)
+                     && stored.magic == MAGIC
+                     && stored.crc == OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        file.close();
+        if (valid) {
+            memcpy(blob, stored.blob, sizeof(blob));
+            blob[sizeof(blob) - 1] = '\0';
+        }
+        return valid;
+    }
+
+    void save() {
+        Stored stored{};
+        stored.magic = MAGIC;
+        memcpy(stored.blob, blob, sizeof(blob));
+        stored.crc = OneWire::crc8(reinterpret_cast<const uint8_t *>(&stored), offsetof(Stored, crc));
+        File file = SPIFFS.open(PATH, "w");
+        if (!file) return;
+        file.write(reinterpret_cast<const uint8_t *>(&stored), sizeof(Stored));
+        file.close();
+    }
+};
+
+constexpr const char *WeeklySchedule::CHANNEL_NAMES[];
+
+WeeklySchedule weeklySchedule;
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef SMARTHATA_HEATING_ZONES_H
+#define SMARTHATA_HEATING_ZONES_H
+
+#include <Arduino.h>
+#include "SensorRegistry.h"
+#include "WeeklySchedule.h"
+
+/**
+ * Floor circuit driven by a mixing valve. The name is used in its topics,
+ * "/heating/<name>/in", "/pid" and "/curve".
+ */
+struct FloorZoneConfig {
+    const char *name;
+    uint8_t upPin;
+    uint8_t downPin;
+    SensorRole mixedRole;
+    SensorRole coldRole;
+    ScheduleChannel schedule;
+    // radiator zone whose room temperature trims the loop, -1 for none
+    int8_t room;
+};
+
+/**
+ * Radiator circuit with an on/off pump, controlled on the temperature
+ * of its room published on "/room/<name>".
+ */
+struct RadiatorZoneConfig {
+    const char *name;
+    uint8_t pumpPin;
+    ScheduleChannel schedule;
+    float normalTemp;
+};
+
+/*
+ * Circuits run by the controller. A new circuit needs
+ * - its sensor roles at the end of SensorRole, with a name in SensorRegistry::ROLE_NAMES and a
+ *   filter in TemperatureSensors, both checked at compile time; a built-in address is optional,
+ *   and the longer role map makes boot drop the stored one once, so the addresses are set again,
+ * - its channel in ScheduleChannel with a name in WeeklySchedule::CHANNEL_NAMES,
+ * - a row here.
+ * Controllers, topics and routes follow the rows. The snapshot and the telemetry log keep the
+ * first six roles only, their layouts are fixed on flash.
+ */
+constexpr FloorZoneConfig FLOOR_ZONES[] = {
+        {"floor", RELAY_MIXER_UP_PIN, RELAY_MIXER_DOWN_PIN, ROLE_MIXED, ROLE_COLD, SCHEDULE_FLOOR, 0},
+};
+
+constexpr RadiatorZoneConfig RADIATOR_ZONES[] = {
+        {"bedroom", RELAY_BATTERY_POMP_PIN, SCHEDULE_BEDROOM, 21.0f},
+};
+
+constexpr byte FLOOR_ZONES_COUNT = sizeof(FLOOR_ZONES) / sizeof(FLOOR_ZONES[0]);
+constexpr byte RADIATOR_ZONES_COUNT = sizeof(RADIATOR_ZONES) / sizeof(RADIATOR_ZONES[0]);
+
+template<byte... I>
+struct ZoneIndexes {
+};
+
+template<byte N, byte... I>
+struct MakeZoneIndexes : MakeZoneIndexes<N - 1, N - 1, I...> {
+};
+
+template<byte... I>
+struct MakeZoneIndexes<0, I...> {
+    typedef ZoneIndexes<I...> type;
+};
+
+/**
+ * One controller per row of a zone table, each built as Controller(zones[i], i).
+ */
+template<typename Controller, typename Config, byte N>
+class ZoneControllers {
+private:
+    Controller controllers[N];
+
+    template<byte... I>
+    ZoneControllers(const Config (&zones)[N], ZoneIndexes<I...>) : controllers{{zones[I], I}...} {
+    }
+
+public:
+
+    explicit ZoneControllers(const Config (&zones)[N]) : ZoneControllers(zones, typename MakeZoneIndexes<N>::type()) {
+    }
+
+    Controller &operator[](byte i) {
+        return controllers[i];
+    }
+
+    const Controller &operator[](byte i) const {
+        return controllers[i];
+    }
+
+    Controller *begin() {
+        return controllers;
+    }
+
+    Controller *end() {
+        return controllers + N;
+    }
+
+    const Controller *begin() const {
+        return controllers;
+    }
+
+    const Controller *end() const {
+        return controllers + N;
+    }
+};
+
+/**
+ * Settings file of a zone: "/curve.bin" for the first one, "/curve1.bin" for the second and so on,
+ * so the first zone keeps the files of the single-zone firmware.
+ */
+inline void zoneFilePath(char *out, size_t size, const char *base, byte zone) {
+    if (zone == 0) {
+        snprintf(out, size, "/%s.bin", base);
+    } else {
+        snprintf(out, size, "/%s%u.bin", base, zone);
+    }
+}
+
+#endif
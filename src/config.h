@@ -17,4 +17,8 @@ const char mqtt_client_id[] = "mqtt_client_id";
 const char mqtt_username[] = "mqtt_username";
 const char mqtt_password[] = "mqtt_password";
 
+// TIME
+const char ntp_server[] = "pool.ntp.org";
+const long time_zone_offset = 3 * 3600;
+
 #endif